@@ -0,0 +1,28 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef AUTOMIX_ALLOC_COUNTER
+
+static thread_local uint64_t thread_allocations = 0;
+
+uint64_t get_thread_allocations() { return thread_allocations; }
+
+void *operator new(std::size_t size) {
+  thread_allocations++;
+  if (size == 0) {
+    size = 1;
+  }
+  void *ptr = std::malloc(size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+#endif
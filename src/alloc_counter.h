@@ -0,0 +1,19 @@
+#ifndef alloc_counter_def
+
+#include <cstdint>
+
+// Number of operator new calls made by the calling thread so far, used to
+// check hot paths stay allocation free. Allocations made inside FFmpeg with
+// av_malloc are not counted. Counting replaces the global operator new, so
+// it is only built with AUTOMIX_ALLOC_COUNTER defined (make ALLOC_COUNTER=1)
+// and reads 0 otherwise.
+#ifdef AUTOMIX_ALLOC_COUNTER
+constexpr bool alloc_counter_enabled = true;
+uint64_t get_thread_allocations();
+#else
+constexpr bool alloc_counter_enabled = false;
+inline uint64_t get_thread_allocations() { return 0; }
+#endif
+
+#define alloc_counter_def
+#endif
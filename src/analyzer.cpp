@@ -1,21 +1,97 @@
+#include <alloc_counter.h>
 #include <analyzer.h>
 #include <bass_detector.h>
 #include <filter.h>
 #include <qm/beat_track.h>
 #include <qm/onset_detect.h>
+#include <spectral_frontend.h>
+#include <tempo_estimator.h>
 
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <mutex>
+#include <thread>
+#include <utility>
 
-constexpr size_t window_size = 1024;
-constexpr size_t step_base = 512; // Fixed
+constexpr size_t full_rate_window_size = 1024;
+constexpr size_t full_rate_step_base = 512;
 constexpr int step_div = 4;
-constexpr size_t step_size = step_base / step_div;
+constexpr int fanout_min_block_hops = 16;
+constexpr int fanout_ring_blocks = 8; // blocks the reader may run ahead
+constexpr double chunk_overlap_seconds = 2; // warm up before each chunk
+constexpr double min_stream_seconds = 60; // enough beats to find a grid in
+constexpr double stream_held_share = 0.25; // of the ceiling, see below
+constexpr int stream_beat_copies = 4; // of the beat detection function
+// Each onset detector feature holds its one value in a vector, a 4 byte
+// allocation that glibc's malloc on 64 bit takes a 32 byte chunk for (24
+// usable and 8 of header). Its label is empty so needs no heap.
+constexpr size_t feature_heap_bytes = 32;
+
+// Plain loops over the block so they vectorize
+static void mix_to_mono(const float *interleaved, float *mono, int frames) {
+  for (int i = 0; i < frames; i++) {
+    mono[i] = (interleaved[i * 2] + interleaved[i * 2 + 1]) * 0.5f;
+  }
+}
+
+// Index of the first sample above threshold or -1, counting first keeps the
+// scan of blocks without noise free of early exits
+static int find_first_above(const float *samples, int length,
+                            double threshold) {
+  int count = 0;
+  for (int i = 0; i < length; i++) {
+    count += samples[i] > threshold;
+  }
+  if (count == 0) {
+    return -1;
+  }
+  for (int i = 0; i < length; i++) {
+    if (samples[i] > threshold) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Window and hops shrink with the analysis rate so the detection functions
+// keep the same frame rate and frequency resolution as at the full rate
+analyzer::analyzer(std::string track_path, const analysis_config &config,
+                   analysis_workspace *workspace)
+    : m_own_workspace(workspace ? nullptr
+                                : std::make_unique<analysis_workspace>()),
+      m_workspace(workspace ? *workspace : *m_own_workspace),
+      m_track(track_path, config.decode_ahead), m_config(config),
+      m_decimator(engine_sample_rate / config.sample_rate),
+      m_beat_envelope(m_workspace.beat_envelope),
+      m_grid_anchor(m_workspace.fine_energy,
+                    engine_sample_rate / m_decimator.get_factor(),
+                    full_rate_step_base / m_decimator.get_factor(),
+                    m_decimator.get_delay()) {
+  m_beat_envelope.clear();
+  m_grid_anchor.clear();
+  m_sample_rate = engine_sample_rate / m_decimator.get_factor();
+  m_window_size = full_rate_window_size / m_decimator.get_factor();
+  m_step_base = full_rate_step_base / m_decimator.get_factor();
+  m_step_div = config.coarse_beats ? 1 : step_div;
+  m_step_size = m_step_base / m_step_div;
+  m_refine_anchor = config.coarse_beats || config.refine_anchor;
+}
 
-analyzer::analyzer(std::string track_path, double input_tempo)
-    : m_track(track_path), m_input_tempo(input_tempo) {}
+// The scratch buffers go back to the workspace for the next track
+analyzer::~analyzer() { m_workspace.arena.rewind(); }
 
 std::shared_ptr<tune> analyzer::get_tune() {
+  if (m_stream_window > 0) {
+    if (!m_stream_summary) {
+      return std::make_shared<tune>(m_track.get_path());
+    }
+    return make_tune(m_stream_tempo, m_stream_first_beat, *m_stream_summary);
+  }
+
   double tempo;
   double first_beat;
   if (create_beat_grid(tempo, first_beat) != 0) {
@@ -33,37 +109,22 @@ std::shared_ptr<tune> analyzer::construct_tune(const double tempo,
                   m_analysis_log_file << std::to_string(n) << std::endl;
                 });
 
-  // get bass content
-  double four_bar_time = 16 * (60.0 / tempo);
-  int beat_section_length_samples = four_bar_time * 44100;
-  int section_count = beat_section_length_samples + (first_beat * 44100);
-  std::vector<double> four_bar_bass_content;
-  std::vector<int> four_bar_drum_content;
-  std::vector<std::pair<int, int>> drops;
-  double bass_track = 0;
-
-  for (int step_idx = 0; step_idx < m_bass_content.size(); step_idx++) {
-    if ((step_idx * step_base) > (first_beat * 44100)) {
-      if ((step_idx * step_base) < section_count) {
-        bass_track += m_bass_content[step_idx];
-      } else {
-        m_analysis_log_file << "step_idx " << std::to_string(step_idx) << " "
-                            << std::to_string(double(section_count) / 44100)
-                            << std::endl;
-        four_bar_bass_content.push_back(bass_track);
-        bass_track = m_bass_content[step_idx];
-        section_count += beat_section_length_samples;
-      }
-    }
+  four_bar_summary summary(tempo, first_beat, m_sample_rate);
+  for (size_t step_idx = 0; step_idx < m_bass_content.size(); step_idx++) {
+    summary.add_bass(step_idx * m_step_base, m_bass_content[step_idx]);
   }
-
-  double time_temp = first_beat;
-
-  while (time_temp < m_onset_features.back()) {
-    four_bar_drum_content.push_back(
-        get_onsets_in_range(time_temp, time_temp + four_bar_time));
-    time_temp += four_bar_time;
+  for (double onset : m_onset_features) {
+    summary.add_onset(onset);
   }
+  return make_tune(tempo, first_beat, summary);
+}
+
+std::shared_ptr<tune> analyzer::make_tune(const double tempo,
+                                          const double first_beat,
+                                          const four_bar_summary &summary) {
+  std::vector<double> four_bar_bass_content = summary.get_bass_content();
+  std::vector<int> four_bar_drum_content = summary.get_drum_content();
+  std::vector<std::pair<int, int>> drops;
 
   std::for_each(four_bar_bass_content.begin(), four_bar_bass_content.end(),
                 [this](double &n) {
@@ -128,118 +189,760 @@ void analyzer::open_log_file() {
   m_analysis_log_file << "Log file for " << m_track.get_path() << std::endl;
 }
 
-void analyzer::run() {
-  int max_window_size =
-      std::max_element(
-          m_processes.begin(), m_processes.end(),
-          [](detector_helper const &s1, detector_helper const &s2) {
-            return s1.window_size < s2.window_size;
-          })
-          ->window_size;
-  int min_step_size = std::min_element(m_processes.begin(), m_processes.end(),
-                                       [](detector_helper const &s1,
-                                          detector_helper const &s2) {
-                                         return s1.step_size < s2.step_size;
-                                       })
-                          ->step_size;
-
-  for (auto helper : m_processes) {
-    if (helper.step_size % min_step_size != 0) {
-      throw;
-    }
-  }
-
-  float *interleaved_samples = new float[min_step_size * 2];
-  float *mono_samples = new float[max_window_size];
-
-  for (int i = 0; i < min_step_size * 2; i++) {
-    interleaved_samples[i] = 0.0;
-  }
-
-  int buf_level = 0;
-  bool noise_found = false;
-
-  while (m_track.read(interleaved_samples, min_step_size * 2) ==
-         min_step_size * 2) {
-    for (int i = 0; i < (min_step_size * 2) - 1; i = i + 2) {
-      mono_samples[(max_window_size - min_step_size) + (i / 2)] =
-          (interleaved_samples[i] + interleaved_samples[i + 1]) * 0.5;
-      if ((!noise_found) &&
-          ((interleaved_samples[i] + interleaved_samples[i + 1]) * 0.5) >
-              m_noise_threshold) {
-        m_first_noise = (buf_level + (i / 2)) / 44100;
-        noise_found = true;
-        m_analysis_log_file << "First noise found at time "
-                            << std::to_string(m_first_noise)
-                            << std::endl; // should be separate detectpr
-      }
+// Reads up to max_hops hops from the track, mixes them down, looks for the
+// first noise at the full rate and decimates into mono_block. Returns the
+// number of whole hops read, fewer than max_hops only at the end.
+int analyzer::read_block(float *mono_block, int hop_size, int max_hops) {
+  int read_size = hop_size * m_decimator.get_factor();
+  size_t block_size = size_t(read_size) * max_hops;
+  if (m_block_capacity < block_size) {
+    m_interleaved_block = m_workspace.arena.allocate(block_size * 2);
+    m_full_rate_block = m_workspace.arena.allocate(block_size);
+    m_block_capacity = block_size;
+  }
+
+  int read_samples = m_track.read(m_interleaved_block, block_size * 2, true);
+  int hops = read_samples / (read_size * 2);
+  if (hops == 0) {
+    return 0;
+  }
+  int frames = hops * read_size;
+
+  mix_to_mono(m_interleaved_block, m_full_rate_block, frames);
+  if (!m_noise_found) {
+    int first = find_first_above(m_full_rate_block, frames, m_noise_threshold);
+    if (first >= 0) {
+      m_first_noise = (m_full_rate_level + first) / engine_sample_rate;
+      m_noise_found = true;
+      m_analysis_log_file << "First noise found at time "
+                          << std::to_string(m_first_noise)
+                          << std::endl; // should be separate detectpr
     }
+  }
+  m_full_rate_level += frames;
+
+  m_decimator.process(m_full_rate_block, frames, mono_block);
+  if (m_refine_anchor && !m_stream_summary) {
+    m_grid_anchor.add(mono_block, hops * hop_size);
+  }
+  return hops;
+}
+
+void analyzer::refine_grid_anchor(double bpm, double &first_beat) {
+  double shift = m_grid_anchor.refine(bpm, first_beat);
+  if (shift == 0) {
+    return;
+  }
+  first_beat += shift;
+  m_analysis_log_file << "Grid anchor refined by "
+                      << std::to_string(shift * 1000) << " ms to "
+                      << std::to_string(first_beat) << std::endl;
+}
+
+// The window is a mirrored ring, each sample is written at its position
+// and again one capacity later so any window of it is contiguous and the
+// detectors read it in place
+static int ring_capacity(int min_size) {
+  int capacity = 1;
+  while (capacity < min_size) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+static void write_mirrored(float *ring, int capacity, long level,
+                           const float *samples, int length) {
+  int ring_pos = level & (capacity - 1);
+  int first_length = std::min(length, capacity - ring_pos);
+  for (int copy : {0, capacity}) {
+    memcpy(ring + ring_pos + copy, samples, first_length * sizeof(float));
+    memcpy(ring + copy, samples + first_length,
+           (length - first_length) * sizeof(float));
+  }
+}
 
-    buf_level += min_step_size;
+template <class... Detectors>
+void analyzer::run(detector_pipeline<Detectors...> &pipeline) {
+  int max_window_size = pipeline.get_max_window_size();
+  int min_step_size = pipeline.get_min_step_size();
 
-    for (detector_helper helper : m_processes) {
-      if (buf_level % helper.step_size == 0 && buf_level >= max_window_size) {
-        helper.process(&mono_samples, Vamp::RealTime::frame2RealTime(
-                                          buf_level - helper.window_size,
-                                          44100)); // time at start of window
+  if (!pipeline.steps_are_multiples_of(min_step_size)) {
+    throw;
+  }
+
+  int block_hops = std::max(m_config.block_hops, 1);
+  int capacity = ring_capacity(max_window_size + min_step_size * block_hops);
+  int mask = capacity - 1;
+  int delay = m_decimator.get_delay();
+  float *mono_block = m_workspace.arena.allocate(min_step_size * block_hops);
+  float *mono_ring = m_workspace.arena.allocate(capacity * 2);
+  long buf_level = 0;
+
+  while (true) {
+    int hops = read_block(mono_block, min_step_size, block_hops);
+    if (hops == 0) {
+      break;
+    }
+    write_mirrored(mono_ring, capacity, buf_level, mono_block,
+                   hops * min_step_size);
+
+    for (int hop = 0; hop < hops; hop++) {
+      buf_level += min_step_size;
+      if (buf_level < max_window_size) {
+        continue;
+      }
+      const float *window = mono_ring + ((buf_level - max_window_size) & mask);
+      uint64_t allocations = get_thread_allocations();
+      pipeline.process(window, buf_level, delay);
+      m_detector_allocations += get_thread_allocations() - allocations;
+      if (m_stream_window > 0 && buf_level % m_stream_window == 0) {
+        reduce_stream_window();
       }
     }
 
-    for (int i = 0; i < max_window_size - min_step_size; i++) {
-      mono_samples[i] = mono_samples[i + min_step_size];
+    if (hops < block_hops) {
+      break; // end of track
     }
   }
+  if (m_stream_window > 0) {
+    reduce_stream_window(); // what was read since the last window
+  }
 }
 
-int analyzer::process() {
-  if (m_track.open_audio_source() != 0) {
-    return 1;
+// Shared between the reading thread and the stage workers in fan out mode.
+// level is the number of mono samples in the ring, progress the level each
+// worker has processed up to.
+struct fanout_state {
+  std::mutex mutex;
+  std::condition_variable data_cv;
+  std::condition_variable space_cv;
+  long level = 0;
+  bool finished = false;
+  std::vector<long> progress;
+  uint64_t allocations = 0;
+};
+
+template <size_t stage, class Pipeline>
+static void fanout_worker(Pipeline &pipeline, fanout_state &state,
+                          const float *ring, int mask, int max_window_size,
+                          int min_step_size, int delay) {
+  long done_level = 0;
+  uint64_t allocations = 0;
+  while (true) {
+    long level;
+    bool finished;
+    {
+      std::unique_lock<std::mutex> lock(state.mutex);
+      state.data_cv.wait(lock, [&] {
+        return state.level > done_level || state.finished;
+      });
+      level = state.level;
+      finished = state.finished;
+    }
+
+    uint64_t start = get_thread_allocations();
+    for (long buf_level = done_level + min_step_size; buf_level <= level;
+         buf_level += min_step_size) {
+      if (buf_level < max_window_size) {
+        continue;
+      }
+      const float *window = ring + ((buf_level - max_window_size) & mask);
+      pipeline.template process_stage<stage>(window, buf_level, delay);
+    }
+    allocations += get_thread_allocations() - start;
+    done_level = level;
+
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.progress[stage] = done_level;
+      if (finished) {
+        state.allocations += allocations;
+      }
+    }
+    state.space_cv.notify_one();
+    if (finished) {
+      return;
+    }
   }
+}
 
-  open_log_file();
+template <class Pipeline, size_t... stages>
+static void start_fanout_workers(std::vector<std::thread> &workers,
+                                 Pipeline &pipeline, fanout_state &state,
+                                 const float *ring, int mask,
+                                 int max_window_size, int min_step_size,
+                                 int delay, std::index_sequence<stages...>) {
+  (workers.push_back(std::thread(fanout_worker<stages, Pipeline>,
+                                 std::ref(pipeline), std::ref(state), ring,
+                                 mask, max_window_size, min_step_size, delay)),
+   ...);
+}
+
+// Each stage of the pipeline runs on its own thread reading the same ring,
+// this thread decodes and decimates ahead of them. Workers only hold up
+// the reader when the slowest would have its window overwritten, they are
+// joined once the track has been read.
+template <class... Detectors>
+void analyzer::run_fanout(detector_pipeline<Detectors...> &pipeline) {
+  int max_window_size = pipeline.get_max_window_size();
+  int min_step_size = pipeline.get_min_step_size();
+
+  if (!pipeline.steps_are_multiples_of(min_step_size)) {
+    throw;
+  }
+
+  // results don't depend on the block size, larger blocks mean fewer
+  // wake ups of the workers
+  int block_hops = std::max(m_config.block_hops, fanout_min_block_hops);
+  int block_length = min_step_size * block_hops;
+  int capacity =
+      ring_capacity(max_window_size + block_length * fanout_ring_blocks);
+  int mask = capacity - 1;
+  int delay = m_decimator.get_delay();
+  float *mono_block = m_workspace.arena.allocate(block_length);
+  float *mono_ring = m_workspace.arena.allocate(capacity * 2);
+  long buf_level = 0;
+
+  fanout_state state;
+  state.progress.assign(sizeof...(Detectors), 0);
+  std::vector<std::thread> workers;
+  start_fanout_workers(workers, pipeline, state, mono_ring, mask,
+                       max_window_size, min_step_size, delay,
+                       std::index_sequence_for<Detectors...>());
+
+  while (true) {
+    int hops = read_block(mono_block, min_step_size, block_hops);
+    long next_level = buf_level + hops * min_step_size;
+    if (hops > 0) {
+      // samples below level - capacity are overwritten, the slowest
+      // worker still reads from its last level minus the window
+      std::unique_lock<std::mutex> lock(state.mutex);
+      state.space_cv.wait(lock, [&] {
+        long slowest =
+            *std::min_element(state.progress.begin(), state.progress.end());
+        return next_level - capacity <= slowest - max_window_size;
+      });
+      lock.unlock();
+      write_mirrored(mono_ring, capacity, buf_level, mono_block,
+                     hops * min_step_size);
+      buf_level = next_level;
+    }
+
+    bool finished = hops < block_hops;
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.level = buf_level;
+      state.finished = finished;
+    }
+    state.data_cv.notify_all();
+    if (finished) {
+      break;
+    }
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  m_detector_allocations += state.allocations;
+}
 
+int analyzer::init_detectors(beat_tracker &beat_analyzer,
+                             onset_detector &detector,
+                             bass_detector &bass_analyzer) {
   // Set up beat tracker
 
-  beat_tracker beat_analyzer = beat_tracker(44100, step_div);
-  beat_analyzer.setParameter("inputtempo", m_input_tempo);
-  std::string df("dftype");
-  beat_analyzer.setParameter(df, 4); // 4 for broadband
+  beat_analyzer.setParameter("inputtempo", m_config.input_tempo);
+  beat_analyzer.setParameter("dftype", m_config.beat_df_type);
 
-  if (beat_analyzer.initialise(1, step_size, window_size) != true) {
+  if (beat_analyzer.initialise(1, m_step_size, m_window_size) != true) {
     m_analysis_log_file << "Error initialising beat track plugin" << std::endl;
     return 1;
   }
-  m_analysis_log_file << "Using detection function "
-                      << beat_analyzer.getParameter(df) << std::endl;
-  register_detector(beat_analyzer, step_size, window_size);
 
   // Set up onset detector
 
-  onset_detector detector = onset_detector(44100);
   std::string program("Percussive onsets");
   detector.selectProgram(program);
 
-  if (detector.initialise(1, step_base, window_size) != true) {
+  if (detector.initialise(1, m_step_base, m_window_size) != true) {
     m_analysis_log_file << "Error initialising onset detector plugin"
                         << std::endl;
     return 1;
   }
-  register_detector(detector, step_base, window_size);
 
   // Set up bass detector
 
-  bass_detector bass_analyzer = bass_detector();
-  if (bass_analyzer.initialise(step_base, step_base) != true) {
+  if (bass_analyzer.initialise(m_step_base, m_step_base) != true) {
     m_analysis_log_file << "Error initialising bass detector" << std::endl;
     return 1;
   }
-  register_detector(bass_analyzer, step_base, step_base);
+  return 0;
+}
+
+// A section of the track analysed on its own thread by its own detectors.
+// The samples start an overlap before start_level so the detectors have
+// settled by the time their results are kept.
+struct analysis_chunk {
+  long first_sample; // level of samples[0]
+  long start_level;  // results up to here are warm up
+  long end_level;
+  std::vector<float> samples;
+  beat_tracker beat;
+  onset_detector detector;
+  bass_detector bass;
+  long transforms = 0;
+  long spectrum_frames = 0;
+  std::thread thread;
+  analysis_chunk(int sample_rate, int beat_step_div)
+      : beat(sample_rate, beat_step_div), detector(sample_rate),
+        bass(sample_rate) {}
+};
+
+analysis_workspace::analysis_workspace() {}
+
+analysis_workspace::~analysis_workspace() {}
+
+// The workspace's detectors are set up for its first track and reset for
+// each track after
+int analyzer::prepare_detectors() {
+  if (m_workspace.beat && m_workspace.sample_rate == m_sample_rate &&
+      m_workspace.step_div == m_step_div &&
+      m_workspace.beat_df_type == m_config.beat_df_type) {
+    m_workspace.beat->setParameter("inputtempo", m_config.input_tempo);
+    m_workspace.beat->reset();
+    m_workspace.detector->reset();
+    m_workspace.bass->reset();
+    m_analysis_log_file << "Reusing detectors, track "
+                        << std::to_string(++m_workspace.tracks)
+                        << " of this worker" << std::endl;
+    return 0;
+  }
 
-  run();
+  m_workspace.chunks.clear();
+  m_workspace.beat = std::make_unique<beat_tracker>(m_sample_rate, m_step_div);
+  m_workspace.detector = std::make_unique<onset_detector>(m_sample_rate);
+  m_workspace.bass = std::make_unique<bass_detector>(m_sample_rate);
+  m_workspace.sample_rate = m_sample_rate;
+  m_workspace.step_div = m_step_div;
+  m_workspace.beat_df_type = m_config.beat_df_type;
+  m_workspace.tracks = 1;
+  if (init_detectors(*m_workspace.beat, *m_workspace.detector,
+                     *m_workspace.bass) != 0) {
+    m_workspace.beat.reset();
+    return 1;
+  }
+  return 0;
+}
+
+// An idle chunk from the workspace is reset, its samples keep their
+// capacity. prepare_detectors has already dropped chunks set up for
+// another rate.
+int analyzer::prepare_chunk(std::unique_ptr<analysis_chunk> &chunk) {
+  if (!m_workspace.chunks.empty()) {
+    chunk = std::move(m_workspace.chunks.back());
+    m_workspace.chunks.pop_back();
+    chunk->beat.setParameter("inputtempo", m_config.input_tempo);
+    chunk->beat.reset();
+    chunk->detector.reset();
+    chunk->bass.reset();
+    return 0;
+  }
+  chunk = std::make_unique<analysis_chunk>(m_sample_rate, m_step_div);
+  return init_detectors(chunk->beat, chunk->detector, chunk->bass);
+}
+
+void analyzer::analyse_chunk(analysis_chunk &chunk, int delay) {
+  spectral_frontend spectrum(m_window_size, m_step_size,
+                             make_subscriber(chunk.beat, m_step_size),
+                             make_subscriber(chunk.detector, m_step_base));
+  detector_pipeline pipeline(
+      make_stage(spectrum, m_step_size, m_window_size),
+      make_stage(chunk.bass, m_step_base, m_step_base));
+  int max_window_size = pipeline.get_max_window_size();
+  int min_step_size = pipeline.get_min_step_size();
+
+  for (long level = chunk.first_sample + max_window_size;
+       level <= chunk.end_level; level += min_step_size) {
+    if (level == chunk.start_level + min_step_size) {
+      chunk.beat.clear_frames();
+      chunk.detector.clear_frames();
+      chunk.bass.clear_frames();
+    }
+    const float *window =
+        chunk.samples.data() + (level - max_window_size - chunk.first_sample);
+    pipeline.process(window, level, delay);
+  }
+  chunk.transforms = spectrum.get_transform_count();
+  chunk.spectrum_frames = spectrum.get_delivered_count();
+}
+
+// The track is still read and decimated in order here, then cut into
+// chunks that are analysed in parallel. The per frame results are put
+// back together in order so only the tempo tracking and peak picking run
+// over the whole track. Chunk boundaries are on onset frames.
+int analyzer::run_chunked(beat_tracker &beat_analyzer, onset_detector &detector,
+                          bass_detector &bass_analyzer, long &transforms,
+                          long &spectrum_frames) {
+  int block_hops = std::max(m_config.block_hops, fanout_min_block_hops);
+  long step_base = m_step_base;
+  long chunk_length =
+      std::max(lround(m_config.chunk_seconds * m_sample_rate) / step_base, 1L) *
+      step_base;
+  long overlap =
+      std::max(long(ceil(chunk_overlap_seconds * m_sample_rate / step_base)) *
+                   step_base,
+               long(m_window_size));
+  int delay = m_decimator.get_delay();
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  float *mono_block = m_workspace.arena.allocate(m_step_size * block_hops);
+  std::vector<float> &pending = m_workspace.pending; // from pending_start on
+  pending.clear();
+  long pending_start = 0;
+  long buf_level = 0;
+  long chunk_start = 0;
+  int num_chunks = 0;
+  bool failed = false;
+  std::deque<std::unique_ptr<analysis_chunk>> running;
+
+  auto finish_chunk = [&]() {
+    analysis_chunk &chunk = *running.front();
+    chunk.thread.join();
+    beat_analyzer.append_frames(chunk.beat);
+    detector.append_frames(chunk.detector);
+    bass_analyzer.append_frames(chunk.bass);
+    transforms += chunk.transforms;
+    spectrum_frames += chunk.spectrum_frames;
+    m_workspace.chunks.push_back(std::move(running.front()));
+    running.pop_front();
+  };
+
+  bool finished = false;
+  while (!finished && !failed) {
+    int hops = read_block(mono_block, m_step_size, block_hops);
+    finished = hops < block_hops;
+    pending.insert(pending.end(), mono_block, mono_block + hops * m_step_size);
+    buf_level += hops * m_step_size;
+
+    while (buf_level - chunk_start >= chunk_length ||
+           (finished && buf_level > chunk_start)) {
+      long chunk_end = std::min(chunk_start + chunk_length, buf_level);
+      std::unique_ptr<analysis_chunk> chunk;
+      if (prepare_chunk(chunk) != 0) {
+        failed = true;
+        break;
+      }
+      chunk->first_sample = std::max(chunk_start - overlap, 0L);
+      chunk->start_level = chunk_start;
+      chunk->end_level = chunk_end;
+      chunk->samples.assign(
+          pending.begin() + (chunk->first_sample - pending_start),
+          pending.begin() + (chunk_end - pending_start));
+
+      if (running.size() >= num_threads) {
+        finish_chunk();
+      }
+      chunk->thread = std::thread(&analyzer::analyse_chunk, this,
+                                  std::ref(*chunk), delay);
+      running.push_back(std::move(chunk));
+      chunk_start = chunk_end;
+      num_chunks++;
+
+      // the next chunk starts an overlap back
+      long keep_from = std::max(chunk_start - overlap, 0L);
+      pending.erase(pending.begin(),
+                    pending.begin() + (keep_from - pending_start));
+      pending_start = keep_from;
+    }
+  }
+
+  while (!running.empty()) {
+    finish_chunk();
+  }
+  if (failed) {
+    return 1;
+  }
+
+  m_analysis_log_file << "Analysed " << std::to_string(num_chunks)
+                      << " chunks of "
+                      << std::to_string(double(chunk_length) / m_sample_rate)
+                      << " s on up to " << std::to_string(num_threads)
+                      << " threads" << std::endl;
+  return 0;
+}
+
+// Memory held per second of a streamed window: the frames of each detector,
+// the copies of the beat detection function made to find the tempo, the
+// onset curve copied for peak picking and a feature per frame returned by
+// the onset detector. The fixed buffers and the decoder aren't counted.
+double analyzer::get_stream_bytes_per_second() {
+  double beat_frames = double(m_sample_rate) / m_step_size;
+  double onset_frames = double(m_sample_rate) / m_step_base;
+  double bytes = beat_frames * sizeof(double) * stream_beat_copies;
+  bytes += onset_frames * (3 * sizeof(double) + sizeof(Vamp::Plugin::Feature) +
+                           feature_heap_bytes);
+  bytes += onset_frames * 2 * sizeof(double); // bass and volume
+  if (m_refine_anchor) {
+    bytes += m_grid_anchor.get_blocks_per_second() * sizeof(float);
+  }
+  return bytes;
+}
+
+// Called as each streamed window has been read. Until there is a grid the
+// onsets and bass of the window are kept with those before it and a grid
+// is tried from them, as long as they fit in the share of the ceiling left
+// for them. Once there is a grid each window is reduced into the four bar
+// summary and only its tempo is logged.
+void analyzer::reduce_stream_window() {
+  beat_tracker &beat_analyzer = *m_workspace.beat;
+  onset_detector &detector = *m_workspace.detector;
+  bass_detector &bass_analyzer = *m_workspace.bass;
+
+  if (m_stream_summary || m_stream_failed) {
+    m_bass_content.clear();
+    m_onset_features.clear();
+    m_onset_values.clear();
+  }
+  if (bass_analyzer.take_frames(m_bass_content) == 0) {
+    beat_analyzer.clear_frames();
+    return;
+  }
+  m_stream_windows++;
+
+  auto o_features = detector.getRemainingFeatures()[0];
+  detector.clear_frames();
+  std::vector<double> onsets = get_timestamps(o_features);
+  m_onset_features.insert(m_onset_features.end(), onsets.begin(),
+                          onsets.end());
+  for (auto &feature : o_features) {
+    m_onset_values.push_back(feature.values[0]);
+  }
+
+  if (m_stream_failed) {
+    beat_analyzer.clear_frames();
+    return;
+  }
+
+  if (m_stream_summary) {
+    for (size_t i = 0; i < m_bass_content.size(); i++) {
+      m_stream_summary->add_bass((m_stream_bass_steps + i) * m_step_base,
+                                 m_bass_content[i]);
+    }
+    m_stream_bass_steps += m_bass_content.size();
+    for (double onset : m_onset_features) {
+      m_stream_summary->add_onset(onset);
+    }
+    log_stream_tempo();
+    beat_analyzer.clear_frames();
+    return;
+  }
+
+  if (m_config.grid_engine == GRID_COMB || m_config.benchmark_grid) {
+    beat_analyzer.get_detection_function(m_beat_envelope);
+    m_envelope_origin = beat_analyzer.get_origin();
+  }
+  if (m_config.grid_engine == GRID_QM || m_config.benchmark_grid) {
+    m_beat_features = get_timestamps(beat_analyzer.getRemainingFeatures()[0]);
+  }
+  beat_analyzer.clear_frames();
+
+  bool has_beats =
+      m_config.grid_engine == GRID_COMB || m_beat_features.size() > 1;
+  double tempo;
+  double first_beat;
+  if (!m_onset_features.empty() && has_beats &&
+      create_beat_grid(tempo, first_beat) == 0) {
+    m_stream_tempo = tempo;
+    m_stream_first_beat = first_beat;
+    m_stream_summary =
+        std::make_unique<four_bar_summary>(tempo, first_beat, m_sample_rate);
+    for (size_t i = 0; i < m_bass_content.size(); i++) {
+      m_stream_summary->add_bass(i * m_step_base, m_bass_content[i]);
+    }
+    m_stream_bass_steps = m_bass_content.size();
+    for (double onset : m_onset_features) {
+      m_stream_summary->add_onset(onset);
+    }
+    m_grid_anchor.clear();
+    m_analysis_log_file << "Grid found in streamed window "
+                        << std::to_string(m_stream_windows) << ": "
+                        << std::to_string(tempo) << " bpm, first beat "
+                        << std::to_string(first_beat) << std::endl;
+    return;
+  }
+
+  double held = (m_bass_content.size() + m_onset_features.size() +
+                 m_onset_values.size()) *
+                    sizeof(double) +
+                m_grid_anchor.get_bytes();
+  if (held > m_config.stream_memory_mb * 1048576.0 * stream_held_share) {
+    m_analysis_log_file << "ERROR no beat grid found within the memory ceiling"
+                        << std::endl;
+    m_stream_failed = true;
+    m_grid_anchor.clear();
+    return;
+  }
+  m_analysis_log_file << "No grid in streamed window "
+                      << std::to_string(m_stream_windows)
+                      << ", keeping its onsets and bass" << std::endl;
+}
+
+// The comb tempo of the window just read and how far its beat is from the
+// grid, so drift over a long recording shows in the log
+void analyzer::log_stream_tempo() {
+  m_workspace.beat->get_detection_function(m_beat_envelope);
+  double origin = m_workspace.beat->get_origin();
+  double frame_rate = double(m_sample_rate) / m_step_size;
+  tempo_estimator estimator(frame_rate, m_stream_tempo);
+  double bpm;
+  double phase;
+  if (estimator.estimate(m_beat_envelope, bpm, phase) != 0) {
+    m_analysis_log_file << "No tempo in streamed window "
+                        << std::to_string(m_stream_windows) << std::endl;
+    return;
+  }
+  double beat = origin + phase / frame_rate;
+  double offset = remainder(beat - m_stream_first_beat, 60.0 / m_stream_tempo);
+  m_analysis_log_file << "Streamed window " << std::to_string(m_stream_windows)
+                      << " from " << std::to_string(origin) << " s: "
+                      << std::to_string(bpm) << " bpm, beat "
+                      << std::to_string(offset * 1000) << " ms from the grid"
+                      << std::endl;
+}
+
+int analyzer::process() {
+  if (m_track.open_audio_source() != 0) {
+    return 1;
+  }
+
+  open_log_file();
+
+  if (m_sample_rate != engine_sample_rate) {
+    m_analysis_log_file << "Analysing mono at " << std::to_string(m_sample_rate)
+                        << " Hz, window " << std::to_string(m_window_size)
+                        << " hop " << std::to_string(m_step_size) << std::endl;
+  }
+
+  if (prepare_detectors() != 0) {
+    return 1;
+  }
+  beat_tracker &beat_analyzer = *m_workspace.beat;
+  onset_detector &detector = *m_workspace.detector;
+  bass_detector &bass_analyzer = *m_workspace.bass;
+  m_analysis_log_file << "Using detection function "
+                      << beat_analyzer.getParameter("dftype") << std::endl;
+
+  // the window length is set by how much a second of it holds
+  if (m_config.stream_memory_mb > 0) {
+    double ceiling = m_config.stream_memory_mb * 1048576.0;
+    double bytes_per_second = get_stream_bytes_per_second();
+    double window_seconds =
+        ceiling * (1 - stream_held_share) / bytes_per_second;
+    if (window_seconds < min_stream_seconds) {
+      m_analysis_log_file << "ERROR memory ceiling of "
+                          << std::to_string(m_config.stream_memory_mb)
+                          << " MB is below the "
+                          << std::to_string(min_stream_seconds *
+                                            bytes_per_second /
+                                            (1 - stream_held_share) / 1048576)
+                          << " MB a " << std::to_string(int(min_stream_seconds))
+                          << " s window needs" << std::endl;
+      return 1;
+    }
+    m_stream_window =
+        long(window_seconds * m_sample_rate / m_step_base) * m_step_base;
+    m_analysis_log_file << "Streaming in windows of "
+                        << std::to_string(double(m_stream_window) /
+                                          m_sample_rate)
+                        << " s" << std::endl;
+  }
+
+  // results are appended per frame, reserve for the whole track or window
+  double reserve_seconds = m_stream_window > 0
+                               ? double(m_stream_window) / m_sample_rate
+                               : m_track.get_duration();
+  size_t frames = reserve_seconds * m_sample_rate / m_step_size + 1;
+  beat_analyzer.reserve_frames(frames);
+  detector.reserve_frames(frames / m_step_div + 1);
+  bass_analyzer.reserve_frames(frames / m_step_div + 1);
+  if (m_refine_anchor) {
+    m_grid_anchor.reserve(reserve_seconds);
+  }
+
+  long transforms = 0, spectrum_frames = 0;
+  if (m_config.chunk_seconds > 0 && m_stream_window == 0) {
+    if (run_chunked(beat_analyzer, detector, bass_analyzer, transforms,
+                    spectrum_frames) != 0) {
+      return 1;
+    }
+  } else if (m_config.fan_out && m_stream_window == 0) {
+    // a stage per detector, the onset frames are transformed again on
+    // their own thread rather than waiting on the beat tracker's
+    spectral_frontend beat_spectrum(
+        m_window_size, m_step_size,
+        make_subscriber(beat_analyzer, m_step_size));
+    spectral_frontend onset_spectrum(m_window_size, m_step_base,
+                                     make_subscriber(detector, m_step_base));
+    detector_pipeline pipeline(
+        make_stage(beat_spectrum, m_step_size, m_window_size),
+        make_stage(onset_spectrum, m_step_base, m_window_size),
+        make_stage(bass_analyzer, m_step_base, m_step_base));
+    run_fanout(pipeline);
+    transforms = beat_spectrum.get_transform_count() +
+                 onset_spectrum.get_transform_count();
+    spectrum_frames = beat_spectrum.get_delivered_count() +
+                      onset_spectrum.get_delivered_count();
+  } else {
+    // magnitude only detectors share one transform per frame, the onset
+    // frames are every step_div'th beat frame
+    spectral_frontend spectrum(m_window_size, m_step_size,
+                               make_subscriber(beat_analyzer, m_step_size),
+                               make_subscriber(detector, m_step_base));
+    detector_pipeline pipeline(
+        make_stage(spectrum, m_step_size, m_window_size),
+        make_stage(bass_analyzer, m_step_base, m_step_base));
+    run(pipeline);
+    transforms = spectrum.get_transform_count();
+    spectrum_frames = spectrum.get_delivered_count();
+  }
+
+  m_analysis_log_file << "Shared spectrum: " << std::to_string(transforms)
+                      << " transforms for " << std::to_string(spectrum_frames)
+                      << " detector frames" << std::endl;
+  if (alloc_counter_enabled) {
+    if (m_config.chunk_seconds <= 0 || m_stream_window > 0) {
+      m_analysis_log_file << "Detector heap allocations: "
+                          << std::to_string(m_detector_allocations)
+                          << std::endl;
+    }
+
+    m_analysis_log_file
+        << "Decode heap allocations after warm-up: "
+        << std::to_string(m_track.get_steady_state_allocations()) << std::endl;
+  }
+
+  if (m_stream_window > 0) {
+    m_vol = bass_analyzer.get_vol();
+    m_analysis_log_file << "Streamed " << std::to_string(m_stream_windows)
+                        << " windows" << std::endl;
+    return 0;
+  }
 
   m_bass_content = bass_analyzer.get_bass_content();
   m_vol = bass_analyzer.get_vol();
-  m_beat_features = get_timestamps(beat_analyzer.getRemainingFeatures()[0]);
+  // the QM tempo tracking runs here, the comb estimate runs on the
+  // detection function when the grid is made
+  if (m_config.grid_engine == GRID_COMB || m_config.benchmark_grid) {
+    beat_analyzer.get_detection_function(m_beat_envelope);
+    m_envelope_origin = beat_analyzer.get_origin();
+  }
+  if (m_config.grid_engine == GRID_QM || m_config.benchmark_grid) {
+    auto start = std::chrono::steady_clock::now();
+    m_beat_features = get_timestamps(beat_analyzer.getRemainingFeatures()[0]);
+    m_qm_track_seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  }
 
   auto o_features = detector.getRemainingFeatures()[0];
   m_onset_features = get_timestamps(o_features);
@@ -258,14 +961,116 @@ int analyzer::process() {
     }
   }
 
-  if (m_beat_features.size() == 0) {
+  if (m_config.grid_engine == GRID_QM && m_beat_features.size() == 0) {
     m_analysis_log_file << "ERROR no beats detected" << std::endl;
     return 1;
   }
+  if (m_config.grid_engine == GRID_COMB && m_beat_envelope.size() == 0) {
+    m_analysis_log_file << "ERROR empty detection function" << std::endl;
+    return 1;
+  }
 
   return 0;
 }
 
+// The tempo to 0.01 BPM from the whole detection function, time is the
+// beat the estimate was aligned to
+int analyzer::get_bpm_comb(double &bpm, double &time) {
+  if (m_onset_features.empty()) {
+    m_analysis_log_file << "ERROR no onsets detected" << std::endl;
+    return 1;
+  }
+
+  double frame_rate = double(m_sample_rate) / m_step_size;
+  tempo_estimator estimator(frame_rate, m_config.input_tempo);
+  double phase;
+  if (estimator.estimate(m_beat_envelope, bpm, phase) != 0) {
+    m_analysis_log_file << "ERROR could not estimate tempo" << std::endl;
+    return 1;
+  }
+  time = m_envelope_origin + phase / frame_rate;
+
+  m_analysis_log_file << "Comb tempo estimate " << std::to_string(bpm)
+                      << " bpm, aligned to beat at " << std::to_string(time)
+                      << std::endl;
+  return 0;
+}
+
+int analyzer::get_grid_tempo(grid_engine_t engine, double &bpm,
+                             double &time) {
+  if (engine == GRID_COMB) {
+    return get_bpm_comb(bpm, time);
+  }
+  return get_bpm(bpm, time);
+}
+
+// Mean distance in seconds from the likely kicks to the nearest eighth of
+// a beat of the grid, a grid with the wrong tempo drifts across them
+double analyzer::get_grid_deviation(double bpm, double first_beat) {
+  double kick_mean;
+  double kick_sd;
+  get_mean_stddev(m_onset_values, kick_mean, kick_sd);
+
+  double eighth = 60.0 / bpm / 8;
+  double total = 0;
+  int count = 0;
+  for (int i = 0; i < m_onset_values.size(); i++) {
+    if (m_onset_values[i] > kick_mean + (kick_sd * 0.5)) {
+      double offset = fmod(m_onset_features[i] - first_beat, eighth);
+      if (offset < 0) {
+        offset += eighth;
+      }
+      total += std::min(offset, eighth - offset);
+      count++;
+    }
+  }
+  return count > 0 ? total / count : 0;
+}
+
+// Makes the grid with each engine and prints the tempo, the time taken
+// and how far the likely kicks are from each grid. The QM time includes
+// its tempo tracking in process().
+void analyzer::benchmark_grid() {
+  std::string summary = m_track.get_path() + ": grid";
+  const grid_engine_t engines[] = {GRID_QM, GRID_COMB};
+  const char *names[] = {"qm", "comb"};
+
+  for (int i = 0; i < 2; i++) {
+    summary += std::string(i > 0 ? "," : "") + " " + names[i] + " ";
+    if (engines[i] == GRID_QM && m_beat_features.empty()) {
+      summary += "no beats";
+      continue;
+    }
+
+    double bpm;
+    double first_beat;
+    auto start = std::chrono::steady_clock::now();
+    int error = get_grid_tempo(engines[i], bpm, first_beat);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (engines[i] == GRID_QM) {
+      seconds += m_qm_track_seconds;
+    }
+    if (error == 0) {
+      error = align_beat_grid(bpm, first_beat);
+    }
+    if (error != 0) {
+      summary += "failed";
+      continue;
+    }
+    if (m_refine_anchor) {
+      refine_grid_anchor(bpm, first_beat);
+    }
+
+    summary += std::to_string(bpm) + " BPM in " +
+               std::to_string(seconds * 1000) + " ms, kicks off grid " +
+               std::to_string(get_grid_deviation(bpm, first_beat) * 1000) +
+               " ms";
+  }
+  std::cout << summary << std::endl;
+}
+
 int analyzer::get_bpm(double &bpm,
                       double &time) { // time will be a plugin beat somewhere
   std::vector<double> beat_gaps;
@@ -398,10 +1203,10 @@ int analyzer::align_beat_grid(
   // if there is an onset before the first noise something has gone wrong
   double silence_to_first_onset = m_onset_features[0] - m_first_noise;
 
-  if (silence_to_first_onset < -1 * (1024.0 / 44100)) {
+  if (silence_to_first_onset < -1 * (double(m_window_size) / m_sample_rate)) {
     m_analysis_log_file << "DIFF "
                         << std::to_string(m_onset_features[0] - m_first_noise -
-                                          (1024 / 44100))
+                                          (m_window_size / m_sample_rate))
                         << std::endl;
     m_analysis_log_file << "Error first onset in silence" << std::endl;
     return 1;
@@ -496,24 +1301,22 @@ int analyzer::align_beat_grid(
 int analyzer::create_beat_grid(double &tempo,
                                double &first_beat) { // todo move to own class
 
-  if (get_bpm(tempo, first_beat) != 0) {
+  if (m_config.benchmark_grid) {
+    benchmark_grid();
+  }
+
+  if (get_grid_tempo(m_config.grid_engine, tempo, first_beat) != 0) {
     return 1;
   }
 
   if (align_beat_grid(tempo, first_beat) != 0) {
     return 1;
   }
-  return 0;
-}
 
-int analyzer::get_onsets_in_range(double start_time, double end_time) {
-  int num_onsets = 0;
-  for (int i = 0; i < m_onset_features.size(); i++) {
-    if (m_onset_features[i] < end_time && m_onset_features[i] > start_time) {
-      num_onsets++;
-    }
+  if (m_refine_anchor) {
+    refine_grid_anchor(tempo, first_beat);
   }
-  return num_onsets;
+  return 0;
 }
 
 std::vector<double>
@@ -526,51 +1329,35 @@ analyzer::get_timestamps(Vamp::Plugin::FeatureList features) {
   return output;
 }
 
-double analyzer::get_distance(std::vector<double> &v1,
-                              std::vector<double> &v2) {
-  assert(v1.size() == v2.size());
-  double distance = 0;
-  for (int i = 0; i < v1.size(); i++) {
-    distance += std::abs(v1[i] - v2[i]);
-  }
-  return distance;
-}
-
 void analyzer::shift(std::vector<double> &v1, double shift_val) {
   std::for_each(v1.begin(), v1.end(),
                 [shift_val](double &n) { n += shift_val; });
 }
 
+// The shift minimising the summed distance between the beats is the
+// median of their differences
 void analyzer::minimise_distance(std::vector<double> &move,
-                                 std::vector<double> &nomove) {
-  // Primitive local minimum algorithm
-  int direction = 1;
-  double init_distance = get_distance(move, nomove);
-  shift(move, 0.001);
-  double fwd_distance = get_distance(move, nomove);
-  shift(move, -0.002);
-  double bwd_distance = get_distance(move, nomove);
-  shift(move, 0.001);
-  if (init_distance < fwd_distance && init_distance < bwd_distance) {
+                                 const std::vector<double> &nomove) {
+  assert(move.size() == nomove.size());
+  if (move.empty()) {
     return;
-  } else if (fwd_distance > bwd_distance) {
-    direction = -1;
-  }
-  double nxt_distance = init_distance;
-  double prev_distance;
-  while (1) {
-    shift(move, direction * 0.001);
-    prev_distance = nxt_distance;
-    nxt_distance = get_distance(move, nomove);
-    if (nxt_distance > prev_distance) {
-      shift(move, direction * -0.001);
-      return;
-    }
   }
+  std::vector<double> differences(move.size());
+  for (size_t i = 0; i < move.size(); i++) {
+    differences[i] = nomove[i] - move[i];
+  }
+  auto middle = differences.begin() + (differences.size() - 1) / 2;
+  std::nth_element(differences.begin(), middle, differences.end());
+  double median = *middle;
+  if (differences.size() % 2 == 0) {
+    // any shift between the two middle differences is as good
+    median = (median + *std::min_element(middle + 1, differences.end())) / 2;
+  }
+  shift(move, median);
 }
 
-void analyzer::get_mean_stddev(std::vector<double> input, double &mean,
-                               double &stddev) {
+void analyzer::get_mean_stddev(const std::vector<double> &input,
+                               double &mean, double &stddev) {
   double cntr = 0;
   for (auto it = input.begin(); it != input.end(); ++it) {
     cntr += *it;
@@ -584,8 +1371,8 @@ void analyzer::get_mean_stddev(std::vector<double> input, double &mean,
   stddev = sqrt(var / input.size());
 }
 
-void analyzer::get_mean_stddev(std::vector<int> input, double &mean,
-                               double &stddev) {
+void analyzer::get_mean_stddev(const std::vector<int> &input,
+                               double &mean, double &stddev) {
   double cntr = 0;
   for (auto it = input.begin(); it != input.end(); ++it) {
     cntr += *it;
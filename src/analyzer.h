@@ -1,3 +1,8 @@
+#include "decimator.h"
+#include "detector_pipeline.h"
+#include "four_bar_summary.h"
+#include "grid_anchor.h"
+#include "scratch_arena.h"
 #include "track.h"
 #include "tune.h"
 #include <vamp-plugin-sdk/vamp-sdk/RealTime.h> // Would be nice to get rid of this
@@ -7,60 +12,137 @@
 
 #ifndef analyzer_def
 
-struct detector_helper {
-  std::function<Vamp::Plugin::FeatureSet(const float *const *inputBuffers,
-                                         Vamp::RealTime timestamp)>
-      process;
-  int step_size;
-  int window_size;
+typedef enum {
+  GRID_QM,   // QM beat tracker then the mean of the consistent beat gaps
+  GRID_COMB, // whole track comb tempo estimate, see tempo_estimator
+} grid_engine_t;
+
+struct analysis_config {
+  double input_tempo = 87.5;
+  bool decode_ahead = false; // decode on a separate thread
+  int sample_rate = engine_sample_rate; // engine rate divided by 1, 2 or 4
+  bool compare_full_rate = false; // also analyse at the engine rate and log
+  int io_queue_depth = 4; // files read ahead of the analysis workers
+  int block_hops = 1;     // hops read and mixed down per track read
+  bool fan_out = false;   // one thread per detector stage
+  double chunk_seconds = 0; // analyse chunks of this length in parallel
+  grid_engine_t grid_engine = GRID_QM;
+  bool benchmark_grid = false; // run every grid engine and print each
+  bool coarse_beats = false;   // beats at the onset hop, anchor refined
+  bool refine_anchor = false;  // anchor refined with the beats at any hop
+  int stream_memory_mb = 0;    // stream in windows within this, 0 is off
+  int beat_df_type = 4;        // beat tracker dftype, 4 broadband 3 complex
+};
+
+class beat_tracker;
+class onset_detector;
+class bass_detector;
+struct analysis_chunk;
+
+// Kept by an analysis worker from one track to the next. The detectors
+// are reset rather than set up again, unless the analysis rate, hop or
+// beat detection function changes, and the buffers are cleared keeping
+// their capacity. Only one analyzer may use a workspace at a time.
+struct analysis_workspace {
+  int sample_rate = 0; // the detectors were set up for
+  int step_div = 0;
+  int beat_df_type = 0;
+  std::unique_ptr<beat_tracker> beat;
+  std::unique_ptr<onset_detector> detector;
+  std::unique_ptr<bass_detector> bass;
+  std::vector<std::unique_ptr<analysis_chunk>> chunks; // idle, for -cl
+  scratch_arena arena; // rewound when the analyzer is done
+  std::vector<float> pending;
+  std::vector<float> fine_energy;
+  std::vector<double> beat_envelope;
+  long tracks = 0;
+  analysis_workspace();
+  ~analysis_workspace();
 };
 
 class analyzer {
 private:
+  std::unique_ptr<analysis_workspace> m_own_workspace; // when none is given
+  analysis_workspace &m_workspace;
   track m_track;
-  double m_input_tempo;
+  analysis_config m_config;
+  decimator m_decimator;
+  int m_sample_rate; // rate the detectors run at
+  size_t m_window_size;
+  size_t m_step_base;
+  size_t m_step_size;
+  int m_step_div; // beat frames per onset frame
   double m_vol;
   std::ofstream m_analysis_log_file;
-  std::vector<detector_helper> m_processes;
   std::vector<double> m_beat_features;
   std::vector<double> m_onset_features;
   std::vector<double> m_onset_values;
   std::vector<double> m_bass_content;
   double m_noise_threshold = 0.03;
   double m_first_noise = -1;
-  template <class T>
-  void register_detector(T &detector, int step_size, int window_size);
-  void run();
+  uint64_t m_detector_allocations = 0;
+  float *m_interleaved_block = nullptr; // from the workspace arena
+  float *m_full_rate_block = nullptr;
+  size_t m_block_capacity = 0; // full rate frames the blocks hold
+  long m_full_rate_level = 0;
+  bool m_noise_found = false;
+  std::vector<double> &m_beat_envelope; // beat detection function
+  double m_envelope_origin = 0;         // time of its first frame
+  double m_qm_track_seconds = 0;        // spent in the QM tempo tracker
+  bool m_refine_anchor;                 // coarse beats or asked for
+  grid_anchor m_grid_anchor;
+  long m_stream_window = 0;    // samples per streamed window, 0 if not
+  int m_stream_windows = 0;    // reduced so far
+  long m_stream_bass_steps = 0; // bass frames already in the summary
+  bool m_stream_failed = false; // no grid within the memory ceiling
+  double m_stream_tempo = 0;
+  double m_stream_first_beat = 0;
+  std::unique_ptr<four_bar_summary> m_stream_summary; // once there's a grid
+  int read_block(float *mono_block, int hop_size, int max_hops);
+  double get_stream_bytes_per_second();
+  void reduce_stream_window();
+  void log_stream_tempo();
+  void refine_grid_anchor(double bpm, double &first_beat);
+  template <class... Detectors>
+  void run(detector_pipeline<Detectors...> &pipeline);
+  template <class... Detectors>
+  void run_fanout(detector_pipeline<Detectors...> &pipeline);
+  int init_detectors(beat_tracker &beat_analyzer, onset_detector &detector,
+                     bass_detector &bass_analyzer);
+  int prepare_detectors();
+  int prepare_chunk(std::unique_ptr<analysis_chunk> &chunk);
+  void analyse_chunk(analysis_chunk &chunk, int delay);
+  int run_chunked(beat_tracker &beat_analyzer, onset_detector &detector,
+                  bass_detector &bass_analyzer, long &transforms,
+                  long &spectrum_frames);
   int create_beat_grid(double &tempo, double &first_beat);
   int align_beat_grid(const double &bpm, double &time);
   int get_bpm(double &bpm, double &time);
+  int get_bpm_comb(double &bpm, double &time);
+  int get_grid_tempo(grid_engine_t engine, double &bpm, double &time);
+  void benchmark_grid();
+  double get_grid_deviation(double bpm, double first_beat);
   std::shared_ptr<tune> construct_tune(const double tempo,
                                        const double first_beat);
+  std::shared_ptr<tune> make_tune(const double tempo, const double first_beat,
+                                  const four_bar_summary &summary);
   std::vector<double> get_timestamps(Vamp::Plugin::FeatureList features);
-  double get_distance(std::vector<double> &v1, std::vector<double> &v2);
-  void shift(std::vector<double> &v1, double shift_val);
-  void minimise_distance(std::vector<double> &move,
-                         std::vector<double> &nomove);
-  void get_mean_stddev(std::vector<double> input, double &mean, double &stddev);
-  void get_mean_stddev(std::vector<int> input, double &mean, double &stddev);
+  static void shift(std::vector<double> &v1, double shift_val);
+  void get_mean_stddev(const std::vector<double> &input, double &mean,
+                       double &stddev);
+  void get_mean_stddev(const std::vector<int> &input, double &mean,
+                       double &stddev);
 
 public:
-  analyzer(std::string track_path, double input_tempo);
+  analyzer(std::string track_path, const analysis_config &config,
+           analysis_workspace *workspace = nullptr);
+  ~analyzer();
   void open_log_file();
   int process();
   std::shared_ptr<tune> get_tune();
-  int get_onsets_in_range(double start_time, double end_time);
+  static void minimise_distance(std::vector<double> &move,
+                                const std::vector<double> &nomove);
 };
 
-template <class T>
-void analyzer::register_detector(T &detector, int step_size, int window_size) {
-  detector_helper helper;
-  helper.process = std::bind(&T::process, &detector, std::placeholders::_1,
-                             std::placeholders::_2);
-  helper.step_size = step_size;
-  helper.window_size = window_size;
-  m_processes.push_back(helper);
-}
-
 #define analyzer_def
 #endif
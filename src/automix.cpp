@@ -9,32 +9,71 @@
 
 #include "analyzer.h"
 #include "dj.h"
+#include "io_scheduler.h"
+#include "library_scanner.h"
 #include "mixer.h"
+#include "pcm_cache.h"
 #include "recorder.h"
 #include "track.h"
 #include "tune.h"
 
 std::mutex tune_mutex;
-std::mutex path_mutex;
+
+// Named bundles of analysis options trading speed for grid accuracy, the
+// window always covers the same time so only the rate and beat hop vary.
+// See developer.rst for what each was measured at.
+struct analysis_preset {
+  const char *name;
+  int rate_div; // of the engine rate
+  bool coarse_beats;
+  bool refine_anchor; // also implied by coarse_beats
+  grid_engine_t grid_engine;
+  int beat_df_type;
+};
+
+const analysis_preset analysis_presets[] = {
+    {"fast", 4, true, true, GRID_COMB, 4},
+    {"balanced", 2, true, true, GRID_COMB, 4},
+    {"accurate", 1, false, true, GRID_COMB, 4},
+};
 
 void analyze_track(std::vector<std::shared_ptr<tune>> &tune_list,
-                   std::vector<std::string> &path_list, double input_tempo) {
-  while (true) {
-    path_mutex.lock();
-    if (path_list.size() == 0) {
-      path_mutex.unlock();
-      return;
+                   io_scheduler &scheduler, const analysis_config &config) {
+  // detectors and buffers kept from track to track by this worker
+  analysis_workspace workspace;
+  analysis_workspace reference_workspace;
+  std::string path;
+  while (scheduler.next(path)) {
+    std::shared_ptr<tune> reference_tune;
+    if (config.compare_full_rate && config.sample_rate != engine_sample_rate) {
+      analysis_config reference_config = config;
+      reference_config.sample_rate = engine_sample_rate;
+      analyzer reference =
+          analyzer(path, reference_config, &reference_workspace);
+      if (reference.process() == 0) {
+        reference_tune = reference.get_tune();
+      }
     }
 
-    analyzer wow = analyzer(path_list.back(), input_tempo);
-    path_list.pop_back();
-    path_mutex.unlock();
-
+    analyzer wow = analyzer(path, config, &workspace);
     if (wow.process() != 0) {
       throw;
     }
 
     std::shared_ptr<tune> analysis_tune = wow.get_tune();
+    if (reference_tune && reference_tune->m_analysis_success &&
+        analysis_tune->m_analysis_success) {
+      std::cout << path << ": " << std::to_string(config.sample_rate)
+                << " Hz analysis differs from full rate by "
+                << std::to_string(analysis_tune->get_original_tempo() -
+                                  reference_tune->get_original_tempo())
+                << " BPM, first beat "
+                << std::to_string(
+                       (analysis_tune->get_original_start_time() -
+                        reference_tune->get_original_start_time()) *
+                       1000)
+                << " ms" << std::endl;
+    }
     tune_mutex.lock();
     tune_list.push_back(analysis_tune);
     tune_mutex.unlock();
@@ -62,7 +101,7 @@ pugi::xml_node get_node_from_path(pugi::xml_document &doc,
 }
 
 std::vector<std::shared_ptr<tune>>
-get_tunes(std::vector<std::string> track_paths, double input_tempo,
+get_tunes(std::vector<std::string> track_paths, const analysis_config &config,
           pugi::xml_document &doc, bool multithreaded, bool re_analyze) {
   int num_threads = std::thread::hardware_concurrency() - 1;
   std::vector<std::thread> thread_vector;
@@ -93,20 +132,21 @@ get_tunes(std::vector<std::string> track_paths, double input_tempo,
   std::cout << std::endl;
 
   if (paths_to_analyze.size() > 0) {
+    io_scheduler scheduler(paths_to_analyze, config.io_queue_depth);
     if (multithreaded) {
       std::cout << "Using " << std::to_string(num_threads)
                 << " threads for track analysis" << std::endl;
       for (int i = 0; i < num_threads; i++) {
         thread_vector.push_back(
             std::thread(analyze_track, std::ref(tunes_from_analysis),
-                        std::ref(paths_to_analyze), input_tempo));
+                        std::ref(scheduler), std::cref(config)));
       }
       for (auto &t : thread_vector) {
         t.join();
       }
     } else {
       std::cout << "Using single thread for track analysis" << std::endl;
-      analyze_track(tunes_from_analysis, paths_to_analyze, input_tempo);
+      analyze_track(tunes_from_analysis, scheduler, config);
     }
   }
 
@@ -143,15 +183,9 @@ get_tunes(std::vector<std::string> track_paths, double input_tempo,
 
 std::vector<std::string> get_track_paths(std::string track_dir_path,
                                          int max_num_tracks) {
-  std::vector<std::string> paths;
-  for (const auto &entry :
-       std::filesystem::directory_iterator(track_dir_path)) {
-    if (entry.path().extension() == ".mp3" ||
-        entry.path().extension() ==
-            ".m4a") { // only support mp3 and m4a for now
-      paths.push_back(entry.path());
-    }
-  }
+  library_scanner scanner(std::string(std::getenv("AUTOMIX_HOME")) +
+                          "/tmp/library.cache");
+  std::vector<std::string> paths = scanner.scan(track_dir_path);
   std::random_shuffle(paths.begin(), paths.end());
   if (paths.size() > max_num_tracks) {
     paths.resize(max_num_tracks);
@@ -221,6 +255,42 @@ void display_help_info() {
   help_stream << "-l      Max number of tracks          Default: 25"
               << std::endl;
   help_stream << "-m      Use multiple threads          Default: false"
+              << std::endl;
+  help_stream << "-cs     Decoded PCM cache size  (MB)  Default: 4096"
+              << std::endl;
+  help_stream << "-p      Decode ahead of analysis      Default: false"
+              << std::endl;
+  help_stream << "-q      Analysis preset               Default: none"
+              << std::endl;
+  help_stream << "        (fast, balanced or accurate, flags override it)"
+              << std::endl;
+  help_stream << "-ar     Analysis sample rate    (Hz)  Default: 44100"
+              << std::endl;
+  help_stream << "        (22050 or 11025 analyse decimated mono)" << std::endl;
+  help_stream << "-ac     Compare to full rate analysis Default: false"
+              << std::endl;
+  help_stream << "-b      Analysis hops per read        Default: 1"
+              << std::endl;
+  help_stream << "-f      Detectors on separate threads Default: false"
+              << std::endl;
+  help_stream << "-cl     Parallel chunk length   (s)   Default: 0 (off)"
+              << std::endl;
+  help_stream << "-bc     Track beats at the onset hop  Default: false"
+              << std::endl;
+  help_stream << "-ge     Beat grid engine              Default: qm"
+              << std::endl;
+  help_stream << "        (qm or comb, comb fits one tempo to the track)"
+              << std::endl;
+  help_stream << "-gb     Benchmark grid engines        Default: false"
+              << std::endl;
+  help_stream << "-sm     Stream within a ceiling (MB)  Default: 0 (off)"
+              << std::endl;
+  help_stream << "        (onsets at window edges can be lost)" << std::endl;
+  help_stream << "-qd     Files to read ahead           Default: 4"
+              << std::endl;
+  help_stream << "-mm     Memory map input files        Default: false"
+              << std::endl;
+  help_stream << "        (-mm willneed also prefetches the whole file)"
               << std::endl
               << std::endl;
   help_stream << "For more detailed descriptions of the functionality of these "
@@ -267,11 +337,27 @@ int main(int argc, char **argv) {
 
   // variables for command line arguements
   bool multithreaded = false;
+  bool decode_ahead = false;
+  input_mode_t input_mode = INPUT_BUFFERED;
   bool update_xml = false;
   int double_drop_prob = 20;
   int breakdown_prob = 20;
   int max_length = 25;
   int seed = 1;
+  int cache_size = 4096;
+  int analysis_rate = engine_sample_rate;
+  bool compare_full_rate = false;
+  int io_queue_depth = 4;
+  int block_hops = 1;
+  bool fan_out = false;
+  double chunk_seconds = 0;
+  bool coarse_beats = false;
+  bool refine_anchor = false;
+  grid_engine_t grid_engine = GRID_QM;
+  bool benchmark_grid = false;
+  int stream_memory_mb = 0;
+  std::string preset_name = "none";
+  int beat_df_type = 4;
   double input_tempo = 87.5;
   double output_tempo = 87.5;
   const int num_channels = 6; // should be enough so there are no timing issues
@@ -319,6 +405,89 @@ int main(int argc, char **argv) {
     multithreaded = true;
   }
 
+  if (in.option_exists("-p")) {
+    decode_ahead = true;
+  }
+
+  // before the flags it sets so they can override it
+  if (in.option_exists("-q")) {
+    preset_name = in.get_option("-q");
+    const analysis_preset *preset = nullptr;
+    for (const analysis_preset &candidate : analysis_presets) {
+      if (preset_name == candidate.name) {
+        preset = &candidate;
+      }
+    }
+    if (preset == nullptr) {
+      std::cerr << "Invalid analysis preset, must be fast, balanced or "
+                   "accurate"
+                << std::endl;
+      return 1;
+    }
+    analysis_rate = engine_sample_rate / preset->rate_div;
+    coarse_beats = preset->coarse_beats;
+    refine_anchor = preset->refine_anchor;
+    grid_engine = preset->grid_engine;
+    beat_df_type = preset->beat_df_type;
+  }
+
+  if (in.option_exists("-ar")) {
+    analysis_rate = std::stoi(in.get_option("-ar"));
+    if (analysis_rate != engine_sample_rate &&
+        analysis_rate != engine_sample_rate / 2 &&
+        analysis_rate != engine_sample_rate / 4) {
+      std::cerr << "Invalid analysis sample rate, must be "
+                << engine_sample_rate << ", " << engine_sample_rate / 2
+                << " or " << engine_sample_rate / 4 << std::endl;
+      return 1;
+    }
+  }
+
+  if (in.option_exists("-ac")) {
+    compare_full_rate = true;
+  }
+
+  if (in.option_exists("-b")) {
+    block_hops = std::max(std::stoi(in.get_option("-b")), 1);
+  }
+
+  if (in.option_exists("-f")) {
+    fan_out = true;
+  }
+
+  if (in.option_exists("-cl")) {
+    chunk_seconds = std::max(std::stod(in.get_option("-cl")), 0.0);
+  }
+
+  if (in.option_exists("-bc")) {
+    coarse_beats = true;
+  }
+
+  if (in.option_exists("-ge")) {
+    grid_engine = in.get_option("-ge") == "comb" ? GRID_COMB : GRID_QM;
+  }
+
+  if (in.option_exists("-gb")) {
+    benchmark_grid = true;
+  }
+
+  if (in.option_exists("-sm")) {
+    stream_memory_mb = std::max(std::stoi(in.get_option("-sm")), 0);
+  }
+
+  if (in.option_exists("-qd")) {
+    io_queue_depth = std::stoi(in.get_option("-qd"));
+  }
+
+  if (in.option_exists("-mm")) {
+    input_mode = in.get_option("-mm") == "willneed" ? INPUT_MMAP_WILLNEED
+                                                    : INPUT_MMAP;
+  }
+
+  if (in.option_exists("-cs")) {
+    cache_size = std::stoi(in.get_option("-cs"));
+  }
+
   if (in.option_exists("-u")) {
     // update_xml = true;   TODO: updating XML node need implementing
   }
@@ -333,6 +502,38 @@ int main(int argc, char **argv) {
                  << std::endl;
   option_message << "     Multithreaded:          " << multithreaded
                  << std::endl;
+  option_message << "     Decode Ahead:           " << decode_ahead
+                 << std::endl;
+  option_message << "     Analysis Preset:        " << preset_name
+                 << std::endl;
+  option_message << "     Analysis Sample Rate:   " << analysis_rate << " Hz"
+                 << std::endl;
+  option_message << "     Compare Full Rate:      " << compare_full_rate
+                 << std::endl;
+  option_message << "     Analysis Block Hops:    " << block_hops << std::endl;
+  option_message << "     Detector Fan Out:       " << fan_out << std::endl;
+  option_message << "     Analysis Chunk Length:  " << chunk_seconds << " s"
+                 << std::endl;
+  option_message << "     Coarse Beat Tracking:   " << coarse_beats
+                 << std::endl;
+  option_message << "     Refine Grid Anchor:     "
+                 << (coarse_beats || refine_anchor) << std::endl;
+  option_message << "     Beat Grid Engine:       "
+                 << (grid_engine == GRID_COMB ? "comb" : "qm") << std::endl;
+  option_message << "     Benchmark Grid Engines: " << benchmark_grid
+                 << std::endl;
+  option_message << "     Streaming Memory Limit: " << stream_memory_mb
+                 << " MB" << std::endl;
+  option_message << "     Read Ahead Queue Depth: " << io_queue_depth
+                 << std::endl;
+  option_message << "     Memory Mapped Input:    "
+                 << (input_mode == INPUT_BUFFERED
+                         ? "off"
+                         : input_mode == INPUT_MMAP ? "sequential"
+                                                    : "willneed")
+                 << std::endl;
+  option_message << "     PCM Cache Size:         " << cache_size << " MB"
+                 << std::endl;
   // option_message << "     Re-process:             " << update_xml <<
   // std::endl;
   option_message << "Mix parameters:" << std::endl;
@@ -356,6 +557,10 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  pcm_cache::configure(std::string(std::getenv("AUTOMIX_HOME")) + "/tmp/pcm",
+                       uint64_t(std::max(cache_size, 0)) * 1024 * 1024);
+  track::set_input_mode(input_mode);
+
   if (!std::filesystem::is_directory(std::filesystem::path(input_dir_path))) {
     std::cerr << "Error input " << input_dir_path
               << " is not an existing directory" << std::endl;
@@ -387,8 +592,24 @@ int main(int argc, char **argv) {
   std::vector<std::string> track_paths =
       get_track_paths(input_dir_path, max_length);
 
+  analysis_config config;
+  config.input_tempo = input_tempo;
+  config.decode_ahead = decode_ahead;
+  config.sample_rate = analysis_rate;
+  config.compare_full_rate = compare_full_rate;
+  config.io_queue_depth = io_queue_depth;
+  config.block_hops = block_hops;
+  config.fan_out = fan_out;
+  config.chunk_seconds = chunk_seconds;
+  config.coarse_beats = coarse_beats;
+  config.refine_anchor = refine_anchor;
+  config.grid_engine = grid_engine;
+  config.benchmark_grid = benchmark_grid;
+  config.stream_memory_mb = stream_memory_mb;
+  config.beat_df_type = beat_df_type;
+
   std::vector<std::shared_ptr<tune>> tune_list =
-      get_tunes(track_paths, input_tempo, doc, multithreaded, 0);
+      get_tunes(track_paths, config, doc, multithreaded, 0);
 
   if (tune_list.size() == 0) {
     std::cerr << "Error could not find any tracks suitable for mixing"
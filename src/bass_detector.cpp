@@ -1,8 +1,12 @@
 #include "bass_detector.h"
 #include <algorithm>
 #include <cmath>
+#include <iostream>
 
-bass_detector::bass_detector() : m_bp(bessel()){};
+constexpr int vol_bins = 4096; // over 0 to 1, full scale is below 0.71
+
+bass_detector::bass_detector(float sample_rate)
+    : m_sample_rate(sample_rate), m_bp(bessel()){};
 
 bool bass_detector::initialise(int step_size, int window_size) {
   if (step_size != window_size) {
@@ -11,39 +15,106 @@ bool bass_detector::initialise(int step_size, int window_size) {
   }
   m_step_size = step_size;
   m_window_size = window_size;
-  m_bp.set_coefs(44110, 100, 0.4,
+  m_bp.set_coefs(m_sample_rate, 100, 0.4,
                  0); // doesn't do anything, parameters are hard coded in filter
-  m_buffer =
-      new float[window_size * 2]; // we receive mono so need space for stereo
+  m_filtered.resize(window_size);
   return true;
 }
 
-Vamp::Plugin::FeatureSet
-bass_detector::process(const float *const *inputBuffers,
-                       Vamp::RealTime timestamp) {
-  for (int i = 0; i < m_window_size * 2; i++) {
-    m_buffer[i] = inputBuffers[0][i / 2]; // back to stereo
-  }
-  m_vol.push_back(get_rms());
-  m_bp.process_samples(m_buffer, m_window_size * 2);
+// The input is mono, the filter runs over the one channel rather than over
+// the same samples duplicated to stereo
+void bass_detector::process_frame(const float *frame, long position) {
+  m_vol.push_back(get_rms(frame));
+  m_bp.process_mono(frame, m_filtered.data(), m_window_size);
+  m_bass.push_back(get_rms(m_filtered.data()));
+}
 
-  m_bass.push_back(get_rms());
+void bass_detector::reset() {
+  m_bp.reset();
+  m_bass.clear();
+  m_vol.clear();
+  m_vol_sums.clear();
+  m_vol_counts.clear();
+  m_vol_max = 0;
+}
 
-  Vamp::Plugin::FeatureSet returnFeatures;
-  return returnFeatures;
+void bass_detector::reserve_frames(size_t frames) {
+  m_bass.reserve(frames);
+  m_vol.reserve(frames);
 }
 
-double bass_detector::get_rms() {
-  double rms = 0;
-  for (int i = 0; i < (m_window_size * 2) - 1; i = i + 2) {
-    rms += pow(std::abs((m_buffer[i] + m_buffer[i + 1]) * 0.5), 2);
+// Divided by twice the window as when the channels were duplicated, so
+// volumes and bass content are on the same scale as before. Summed in
+// four lanes, which the compiler packs into vector adds.
+double bass_detector::get_rms(const float *samples) {
+  double sums[4] = {0, 0, 0, 0};
+  int i = 0;
+  for (; i + 3 < m_window_size; i += 4) {
+    for (int lane = 0; lane < 4; lane++) {
+      sums[lane] += double(samples[i + lane]) * samples[i + lane];
+    }
   }
-  return pow(rms / (m_window_size * 2), 0.5);
+  for (; i < m_window_size; i++) {
+    sums[0] += double(samples[i]) * samples[i];
+  }
+  double rms = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+  return sqrt(rms / (m_window_size * 2));
+}
+
+void bass_detector::clear_frames() {
+  m_bass.clear();
+  m_vol.clear();
+}
+
+void bass_detector::append_frames(const bass_detector &chunk) {
+  m_bass.insert(m_bass.end(), chunk.m_bass.begin(), chunk.m_bass.end());
+  m_vol.insert(m_vol.end(), chunk.m_vol.begin(), chunk.m_vol.end());
 }
 
 std::vector<double> bass_detector::get_bass_content() { return m_bass; }
 
+size_t bass_detector::take_frames(std::vector<double> &bass) {
+  size_t frames = m_bass.size();
+  bass.insert(bass.end(), m_bass.begin(), m_bass.end());
+  m_bass.clear();
+  bin_vols();
+  return frames;
+}
+
+void bass_detector::bin_vols() {
+  if (m_vol_counts.empty()) {
+    m_vol_sums.assign(vol_bins, 0);
+    m_vol_counts.assign(vol_bins, 0);
+  }
+  for (auto vol : m_vol) {
+    int bin = std::min(int(vol * vol_bins), vol_bins - 1);
+    m_vol_sums[bin] += vol;
+    m_vol_counts[bin]++;
+    m_vol_max = std::max(m_vol_max, vol);
+  }
+  m_vol.clear();
+}
+
+// The mean of the volumes within 80% of the loudest. Once frames have been
+// taken the binned volumes are used, where only the bin holding the
+// threshold is counted whole or not at all by its mean.
 double bass_detector::get_vol() {
+  if (!m_vol_counts.empty()) {
+    bin_vols();
+    double threshold = 0.8 * m_vol_max;
+    double total_vol = 0;
+    int num_vols = 0;
+    for (int bin = 0; bin < vol_bins; bin++) {
+      if (m_vol_counts[bin] > 0 &&
+          (double(bin) / vol_bins > threshold ||
+           m_vol_sums[bin] / m_vol_counts[bin] > threshold)) {
+        total_vol += m_vol_sums[bin];
+        num_vols += m_vol_counts[bin];
+      }
+    }
+    return total_vol / num_vols;
+  }
+
   auto vol_max = std::max_element(m_vol.begin(), m_vol.end());
   double threshold = 0.8 * (*vol_max);
   double total_vol = 0;
@@ -1,24 +1,35 @@
 #include "filter.h"
-#include "qm/beat_track.h"
-#include <vamp-plugin-sdk/vamp-sdk/RealTime.h> // Would be nice to get rid of this
 
+#include <cstddef>
 #include <vector>
 
 class bass_detector {
 private:
+  float m_sample_rate;
   int m_step_size;
   int m_window_size;
-  float *m_buffer;
+  std::vector<float> m_filtered;
   bessel m_bp;
   std::vector<double> m_bass;
   std::vector<double> m_vol;
-  double get_rms();
+  // volumes of frames already taken, binned with their sum per bin
+  std::vector<double> m_vol_sums;
+  std::vector<int> m_vol_counts;
+  double m_vol_max = 0;
+  double get_rms(const float *samples);
+  void bin_vols();
 
 public:
-  bass_detector();
+  bass_detector(float sample_rate);
   bool initialise(int step_size, int window_size);
-  Vamp::Plugin::FeatureSet process(const float *const *inputBuffers,
-                                   Vamp::RealTime timestamp);
+  void reset(); // for the next track, keeps the filter design and buffers
+  void process_frame(const float *frame, long position);
+  void reserve_frames(size_t frames);
+  void clear_frames(); // keeps the filter state
+  void append_frames(const bass_detector &chunk);
   std::vector<double> get_bass_content();
+  // Appends the bass content so far to bass and clears it, the volumes are
+  // binned so get_vol still covers every frame. Returns the frames taken.
+  size_t take_frames(std::vector<double> &bass);
   double get_vol();
 };
\ No newline at end of file
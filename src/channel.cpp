@@ -7,8 +7,9 @@ static const double lpf_gain = 0;
 
 channel::channel() : m_tempo(tempo()), m_lpf(biquad()), m_bp(bessel()) {
   m_track = nullptr;
-  m_lpf.set_coefs(44100, kStartupLoFreq, kQKill, lpf_gain);
-  m_bp.set_coefs(44110, 50, 3.0, 1); // Warning, hardcoded in filter
+  m_lpf.set_coefs(engine_sample_rate, kStartupLoFreq, kQKill, lpf_gain);
+  m_bp.set_coefs(engine_sample_rate, 50, 3.0,
+                 1); // Warning, hardcoded in filter
   m_time = 0;
   m_volume = 0.0;
   m_state = pause;
@@ -43,7 +44,7 @@ int channel::apply_action(action_t action) {
   if (action.control == LPF) {
     std::cout << "setting lpf gain to " << std::to_string(action.value)
               << " at time " << std::to_string(m_time) << std::endl;
-    m_lpf.set_coefs(44100, kStartupLoFreq, kQKill, action.value);
+    m_lpf.set_coefs(engine_sample_rate, kStartupLoFreq, kQKill, action.value);
   } else if (action.control == VOL) {
     std::cout << "setting volume to " << std::to_string(action.value)
               << " at time " << std::to_string(m_time) << std::endl;
@@ -59,6 +60,7 @@ int channel::apply_action(action_t action) {
               << std::endl;
     m_tempo.set_tempo_ratio(action.value);
   } else {
+    delete m_track; // releases decoder and any partial PCM cache file
     m_track = new track(action.path);
     m_tempo.load(m_track);
     int err = m_track->open_audio_source();
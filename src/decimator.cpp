@@ -0,0 +1,67 @@
+#include "decimator.h"
+
+#include <cmath>
+#include <cstring>
+
+#define TAPS_PER_FACTOR 24
+#define CUTOFF 0.4 // of the output rate, leaves room for the transition band
+
+decimator::decimator(int factor) : m_factor(factor) {
+  if (m_factor <= 1) {
+    m_factor = 1;
+    return;
+  }
+
+  int order = TAPS_PER_FACTOR * m_factor;
+  double cutoff = CUTOFF / m_factor; // cycles per input sample
+  double sum = 0;
+  m_taps.resize(order + 1);
+  for (int n = 0; n <= order; n++) {
+    double x = n - order / 2.0;
+    double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+    double window = 0.42 - 0.5 * cos(2 * M_PI * n / order) +
+                    0.08 * cos(4 * M_PI * n / order);
+    m_taps[n] = sinc * window;
+    sum += m_taps[n];
+  }
+  for (auto &tap : m_taps) {
+    tap /= sum; // unity gain at DC
+  }
+  m_buffer.assign(order, 0.0f);
+}
+
+int decimator::get_factor() { return m_factor; }
+
+// Group delay in output samples
+int decimator::get_delay() {
+  return m_taps.empty() ? 0 : (m_taps.size() - 1) / 2 / m_factor;
+}
+
+// num_samples must be a multiple of the factor, writes num_samples / factor
+void decimator::process(const float *input, int num_samples, float *output) {
+  if (m_factor == 1) {
+    memcpy(output, input, num_samples * sizeof(float));
+    return;
+  }
+
+  int history = m_taps.size() - 1;
+  m_buffer.resize(history + num_samples);
+  memcpy(m_buffer.data() + history, input, num_samples * sizeof(float));
+
+  // output i is centred on the first input of its group, looping over
+  // outputs innermost keeps each sum in tap order and lets the loop vectorize
+  int num_outputs = num_samples / m_factor;
+  for (int i = 0; i < num_outputs; i++) {
+    output[i] = 0;
+  }
+  for (size_t t = 0; t < m_taps.size(); t++) {
+    float tap = m_taps[t];
+    const float *window = m_buffer.data() + t;
+    for (int i = 0; i < num_outputs; i++) {
+      output[i] += tap * window[i * m_factor];
+    }
+  }
+
+  memmove(m_buffer.data(), m_buffer.data() + num_samples,
+          history * sizeof(float));
+}
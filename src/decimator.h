@@ -0,0 +1,21 @@
+#ifndef decimator_def
+
+#include <vector>
+
+// Anti-alias low pass followed by keeping every factor'th sample. Blackman
+// windowed sinc FIR, only the kept outputs are computed.
+class decimator {
+private:
+  int m_factor;
+  std::vector<float> m_taps;
+  std::vector<float> m_buffer; // taps - 1 samples of history then new input
+
+public:
+  decimator(int factor);
+  int get_factor();
+  int get_delay();
+  void process(const float *input, int num_samples, float *output);
+};
+
+#define decimator_def
+#endif
@@ -0,0 +1,80 @@
+#ifndef detector_pipeline_def
+
+#include <algorithm>
+#include <cstddef>
+#include <tuple>
+
+// A detector in the pipeline provides
+//   void process_frame(const float *frame, long position);
+// which is called every step_size samples. position is the sample index
+// of the start of the frame at the analysis rate, it is negative while
+// the decimator delay is still being filled. Detectors keep their own
+// results.
+template <class T> struct detector_stage {
+  T *detector;
+  int step_size;
+  int window_size;
+};
+
+template <class T>
+detector_stage<T> make_stage(T &detector, int step_size, int window_size) {
+  return detector_stage<T>{&detector, step_size, window_size};
+}
+
+// Detectors composed at compile time, each hop is a direct call per stage
+// with nothing allocated or type erased
+template <class... Detectors> class detector_pipeline {
+private:
+  std::tuple<detector_stage<Detectors>...> m_stages;
+
+  template <class T>
+  static void run_stage(detector_stage<T> &stage, const float *frame,
+                        long buf_level, int delay) {
+    if (buf_level % stage.step_size == 0) {
+      stage.detector->process_frame(frame,
+                                    buf_level - stage.window_size - delay);
+    }
+  }
+
+public:
+  detector_pipeline(detector_stage<Detectors>... stages)
+      : m_stages(stages...) {}
+
+  int get_max_window_size() const {
+    return std::apply(
+        [](const auto &...stage) { return std::max({stage.window_size...}); },
+        m_stages);
+  }
+
+  int get_min_step_size() const {
+    return std::apply(
+        [](const auto &...stage) { return std::min({stage.step_size...}); },
+        m_stages);
+  }
+
+  bool steps_are_multiples_of(int step_size) const {
+    return std::apply(
+        [step_size](const auto &...stage) {
+          return ((stage.step_size % step_size == 0) && ...);
+        },
+        m_stages);
+  }
+
+  // frame is the start of the longest window, which ends at buf_level
+  void process(const float *frame, long buf_level, int delay) {
+    std::apply(
+        [&](auto &...stage) {
+          (run_stage(stage, frame, buf_level, delay), ...);
+        },
+        m_stages);
+  }
+
+  // A single stage, for running the stages on separate threads
+  template <size_t index>
+  void process_stage(const float *frame, long buf_level, int delay) {
+    run_stage(std::get<index>(m_stages), frame, buf_level, delay);
+  }
+};
+
+#define detector_pipeline_def
+#endif
@@ -0,0 +1,9 @@
+#ifndef engine_def
+
+// Format everything downstream of track works in, sources are converted to
+// this when they are decoded
+constexpr int engine_sample_rate = 44100;
+constexpr int engine_channels = 2;
+
+#define engine_def
+#endif
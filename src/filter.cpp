@@ -172,6 +172,19 @@ void bessel::process_samples(float *samples, int frame_size) {
   }
 }
 
+void bessel::reset() {
+  memset(m_buf1, 0, sizeof(m_buf1));
+  memset(m_buf2, 0, sizeof(m_buf2));
+}
+
+// A single channel through the first channel's state, input and output
+// may be the same
+void bessel::process_mono(const float *input, float *output, int frame_size) {
+  for (int i = 0; i < frame_size; i++) {
+    output[i] = process(m_coef_fl, m_buf1, input[i]);
+  }
+}
+
 inline float bessel::process(float *coef, float *buf, float val) {
   float tmp, fir, iir;
   tmp = buf[0];
@@ -36,6 +36,8 @@ public:
                  double dBgain);
   void print_coefs(void);
   void process_samples(float *samples, int frame_size);
+  void process_mono(const float *input, float *output, int frame_size);
+  void reset(); // clears the filter state, keeps the coefficients
   float process(float *coef, float *buf, float val);
 };
 #define filter_def
@@ -0,0 +1,49 @@
+#include "four_bar_summary.h"
+
+#include <cmath>
+
+// Sections are counted in samples at the analysis rate and truncated as
+// the whole track summary always was
+four_bar_summary::four_bar_summary(double tempo, double first_beat,
+                                   int sample_rate)
+    : m_first_beat(first_beat), m_four_bar_time(16 * (60.0 / tempo)),
+      m_first_beat_sample(first_beat * sample_rate) {
+  m_section_samples = long(m_four_bar_time * sample_rate);
+  m_first_boundary = long(m_section_samples + m_first_beat_sample);
+}
+
+void four_bar_summary::add_bass(long sample, double bass) {
+  if (sample <= m_first_beat_sample) {
+    return;
+  }
+  size_t section =
+      sample < m_first_boundary
+          ? 0
+          : 1 + (sample - m_first_boundary) / m_section_samples;
+  if (section >= m_bass.size()) {
+    m_bass.resize(section + 1, 0);
+  }
+  m_bass[section] += bass;
+}
+
+void four_bar_summary::add_onset(double time) {
+  if (time <= m_first_beat) {
+    return;
+  }
+  size_t section = size_t(floor((time - m_first_beat) / m_four_bar_time));
+  if (section >= m_drums.size()) {
+    m_drums.resize(section + 1, 0);
+  }
+  m_drums[section]++;
+}
+
+std::vector<double> four_bar_summary::get_bass_content() const {
+  if (m_bass.empty()) {
+    return m_bass;
+  }
+  return std::vector<double>(m_bass.begin(), m_bass.end() - 1);
+}
+
+std::vector<int> four_bar_summary::get_drum_content() const {
+  return m_drums;
+}
@@ -0,0 +1,28 @@
+#ifndef four_bar_summary_def
+
+#include <vector>
+
+// Bass content and onset counts per four bars of a beat grid. Bass frames
+// and onsets are added one at a time in any order, so a streamed analysis
+// can reduce them as it goes rather than keep them for the whole track.
+class four_bar_summary {
+private:
+  double m_first_beat;        // in seconds
+  double m_four_bar_time;     // in seconds
+  double m_first_beat_sample; // bass frames at or before it are skipped
+  long m_first_boundary;      // sample the second four bars start at
+  long m_section_samples;
+  std::vector<double> m_bass;
+  std::vector<int> m_drums;
+
+public:
+  four_bar_summary(double tempo, double first_beat, int sample_rate);
+  void add_bass(long sample, double bass); // sample the frame starts at
+  void add_onset(double time);
+  // The four bars being played at the end are incomplete and left out
+  std::vector<double> get_bass_content() const;
+  std::vector<int> get_drum_content() const;
+};
+
+#define four_bar_summary_def
+#endif
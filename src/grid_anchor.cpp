@@ -0,0 +1,98 @@
+#include "grid_anchor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define BLOCKS_PER_STEP 16
+
+grid_anchor::grid_anchor(std::vector<float> &energy, int sample_rate,
+                         int step_size, int delay)
+    : m_energy(energy), m_sample_rate(sample_rate),
+      m_block(step_size / BLOCKS_PER_STEP), m_delay(delay) {}
+
+double grid_anchor::get_blocks_per_second() {
+  return double(m_sample_rate) / m_block;
+}
+
+// Hops are whole blocks so each block is summed in one call
+void grid_anchor::add(const float *samples, int length) {
+  for (int start = 0; start + int(m_block) <= length; start += m_block) {
+    float energy = 0;
+    for (size_t i = 0; i < m_block; i++) {
+      energy += samples[start + i] * samples[start + i];
+    }
+    m_energy.push_back(energy);
+  }
+}
+
+void grid_anchor::reserve(double seconds) {
+  m_energy.reserve(seconds * get_blocks_per_second() + 1);
+}
+
+void grid_anchor::clear() { m_energy.clear(); }
+
+size_t grid_anchor::get_bytes() { return m_energy.size() * sizeof(float); }
+
+// The beat tracker and the onset alignment place the grid only to within
+// a hop. Returns the shift in seconds to where the energy rises most
+// sharply on average over every beat, within a hop either side, at block
+// resolution, or 0 if there isn't enough signal. The rise at a block is
+// the log ratio of the energy in the half hop after its start to the half
+// hop before.
+double grid_anchor::refine(double bpm, double first_beat) {
+  int window = BLOCKS_PER_STEP / 2;
+  int range = BLOCKS_PER_STEP;
+  int count = m_energy.size();
+  if (count < 4 * range) {
+    return 0;
+  }
+
+  std::vector<double> sum(count + 1, 0);
+  for (int i = 0; i < count; i++) {
+    sum[i + 1] = sum[i] + m_energy[i];
+  }
+  double energy_floor = 0.001 * sum[count] / count * window;
+  std::vector<double> rise(count, 0);
+  for (int i = window; i + window <= count; i++) {
+    double before = sum[i] - sum[i - window];
+    double after = sum[i + window] - sum[i];
+    rise[i] =
+        std::max(0.0, log((after + energy_floor) / (before + energy_floor)));
+  }
+
+  // the rise peaks at the block an onset falls in, taken as its centre.
+  // block i starts at analysis sample i * m_block, which lags the track by
+  // the delay
+  double blocks_per_second = get_blocks_per_second();
+  double delay_blocks = double(m_delay) / m_block - 0.5;
+  double beat_blocks = 60.0 / bpm * blocks_per_second;
+  double first = first_beat * blocks_per_second + delay_blocks;
+  first -= floor(first / beat_blocks) * beat_blocks;
+  while (first < range) {
+    first += beat_blocks;
+  }
+
+  std::vector<double> score(2 * range + 1, 0);
+  for (int offset = -range; offset <= range; offset++) {
+    for (double position = first; position + range + 1 < count;
+         position += beat_blocks) {
+      int index = int(position) + offset;
+      double fraction = position - int(position);
+      score[offset + range] +=
+          rise[index] * (1 - fraction) + rise[index + 1] * fraction;
+    }
+  }
+
+  int best = std::max_element(score.begin(), score.end()) - score.begin();
+  if (score[best] <= 0) {
+    return 0;
+  }
+  double shift = best - range;
+  if (best > 0 && best < 2 * range) {
+    double curvature = score[best - 1] - 2 * score[best] + score[best + 1];
+    if (curvature < 0) {
+      shift += 0.5 * (score[best - 1] - score[best + 1]) / curvature;
+    }
+  }
+  return shift / blocks_per_second;
+}
@@ -0,0 +1,29 @@
+#ifndef grid_anchor_def
+
+#include <cstddef>
+#include <vector>
+
+// Energy of the analysis signal in blocks of a sixteenth of an onset hop,
+// kept while a track is read so that the grid anchor can be moved onto the
+// attacks of the drums once the grid is found. The energies are held in a
+// vector the caller owns, so its capacity can be kept from track to track.
+class grid_anchor {
+private:
+  std::vector<float> &m_energy;
+  int m_sample_rate; // of the analysis signal
+  size_t m_block;    // analysis samples per block
+  int m_delay;       // analysis samples the signal lags the track by
+
+public:
+  grid_anchor(std::vector<float> &energy, int sample_rate, int step_size,
+              int delay);
+  double get_blocks_per_second();
+  void add(const float *samples, int length);
+  void reserve(double seconds);
+  void clear();
+  size_t get_bytes();
+  double refine(double bpm, double first_beat);
+};
+
+#define grid_anchor_def
+#endif
@@ -0,0 +1,104 @@
+#include "io_scheduler.h"
+#include "pcm_cache.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Physical offset of the start of the file, so files are read in the order
+// they sit on the disk. Not every filesystem supports this (NFS doesn't),
+// those fall back to inode order which roughly follows creation order.
+static uint64_t get_physical_offset(int fd) {
+  alignas(struct fiemap) char
+      buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+  struct fiemap *map = reinterpret_cast<struct fiemap *>(buffer);
+  map->fm_start = 0;
+  map->fm_length = FIEMAP_MAX_OFFSET;
+  map->fm_extent_count = 1;
+
+  if (ioctl(fd, FS_IOC_FIEMAP, map) != 0 || map->fm_mapped_extents == 0) {
+    return 0;
+  }
+  return map->fm_extents[0].fe_physical;
+}
+
+io_scheduler::io_scheduler(const std::vector<std::string> &paths,
+                           int queue_depth)
+    : m_next(0), m_prefetched(0), m_queue_depth(queue_depth) {
+  for (const auto &path : paths) {
+    io_entry entry = {path, 0, 0, 0};
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      struct stat file_stat;
+      if (fstat(fd, &file_stat) == 0) {
+        entry.device = file_stat.st_dev;
+        entry.inode = file_stat.st_ino;
+      }
+      entry.physical = get_physical_offset(fd);
+      close(fd);
+    }
+    m_entries.push_back(entry);
+  }
+
+  std::sort(m_entries.begin(), m_entries.end(),
+            [](const io_entry &a, const io_entry &b) {
+              if (a.device != b.device) {
+                return a.device < b.device;
+              }
+              if (a.physical != b.physical) {
+                return a.physical < b.physical;
+              }
+              return a.inode < b.inode;
+            });
+}
+
+// Starts readahead of a file without waiting for it. A track with a decoded
+// copy in the PCM cache is read from there so advise that instead.
+void io_scheduler::prefetch(const std::string &path) {
+  std::string read_path = path;
+  std::string entry_path;
+  pcm_cache_header header;
+  if (pcm_cache::enabled() &&
+      pcm_cache::get_entry(path, entry_path, header) == 0 &&
+      std::filesystem::is_regular_file(entry_path)) {
+    read_path = entry_path;
+  }
+
+  int fd = open(read_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+bool io_scheduler::next(std::string &path) {
+  std::vector<std::string> to_prefetch;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_next >= m_entries.size()) {
+      return false;
+    }
+    path = m_entries[m_next++].path;
+
+    // the file just handed out is about to be read anyway
+    m_prefetched = std::max(m_prefetched, m_next);
+    size_t end = std::min(m_next + std::max(m_queue_depth, 0),
+                          m_entries.size());
+    for (; m_prefetched < end; m_prefetched++) {
+      to_prefetch.push_back(m_entries[m_prefetched].path);
+    }
+  }
+
+  // outside the lock, opening files on a network mount can be slow
+  for (const auto &prefetch_path : to_prefetch) {
+    prefetch(prefetch_path);
+  }
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef io_scheduler_def
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct io_entry {
+  std::string path;
+  uint64_t device;
+  uint64_t physical; // byte offset of the first extent, 0 if unknown
+  uint64_t inode;
+};
+
+// Hands out files to analysis workers in on-disk order and asks the kernel
+// to start reading the next queue_depth files before they are needed
+class io_scheduler {
+private:
+  std::vector<io_entry> m_entries;
+  size_t m_next;
+  size_t m_prefetched; // entries before this have been advised
+  int m_queue_depth;
+  std::mutex m_mutex;
+  static void prefetch(const std::string &path);
+
+public:
+  io_scheduler(const std::vector<std::string> &paths, int queue_depth);
+  bool next(std::string &path);
+};
+
+#define io_scheduler_def
+#endif
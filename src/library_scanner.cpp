@@ -0,0 +1,283 @@
+#include "library_scanner.h"
+#include "pcm_reader.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+static const char scan_cache_magic[8] = {'A', 'M', 'X', 'L',
+                                         'I', 'B', '0', '1'};
+
+static int64_t get_mtime(const struct stat &file_stat) {
+  return int64_t(file_stat.st_mtim.tv_sec) * 1000000000 +
+         file_stat.st_mtim.tv_nsec;
+}
+
+static void write_string(std::ofstream &file, const std::string &value) {
+  uint32_t length = value.size();
+  file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+  file.write(value.data(), length);
+}
+
+static bool read_string(std::ifstream &file, std::string &value) {
+  uint32_t length;
+  if (!file.read(reinterpret_cast<char *>(&length), sizeof(length)) ||
+      length > PATH_MAX) {
+    return false;
+  }
+  value.resize(length);
+  return bool(file.read(&value[0], length));
+}
+
+template <class T> static void write_value(std::ofstream &file, T value) {
+  file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <class T> static bool read_value(std::ifstream &file, T &value) {
+  return bool(file.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+library_scanner::library_scanner(const std::string &cache_path)
+    : m_cache_path(cache_path), m_pending(0), m_reused(0) {}
+
+bool library_scanner::is_track_file(const std::string &path) {
+  std::string extension = std::filesystem::path(path).extension();
+  return extension == ".mp3" || extension == ".m4a" ||
+         pcm_reader::is_pcm_file(path);
+}
+
+int library_scanner::load_cache() {
+  std::ifstream file(m_cache_path, std::ios::binary);
+  if (!file.is_open()) {
+    return 1;
+  }
+
+  char magic[8];
+  uint32_t num_dirs;
+  if (!file.read(magic, sizeof(magic)) ||
+      memcmp(magic, scan_cache_magic, sizeof(magic)) != 0 ||
+      !read_value(file, num_dirs)) {
+    std::cout << "Ignoring invalid library cache " << m_cache_path
+              << std::endl;
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < num_dirs; i++) {
+    std::string dir_path;
+    scan_directory dir;
+    uint32_t num_subdirs, num_files;
+    if (!read_string(file, dir_path) || !read_value(file, dir.mtime) ||
+        !read_value(file, num_subdirs)) {
+      break;
+    }
+    dir.subdirs.resize(num_subdirs);
+    for (auto &subdir : dir.subdirs) {
+      read_string(file, subdir);
+    }
+    if (!read_value(file, num_files)) {
+      break;
+    }
+    dir.files.resize(num_files);
+    for (auto &entry : dir.files) {
+      read_string(file, entry.name);
+      read_value(file, entry.size);
+      read_value(file, entry.mtime);
+      read_value(file, entry.inode);
+    }
+    if (!file) {
+      break; // truncated, keep what was read in full
+    }
+    m_cache[dir_path] = std::move(dir);
+  }
+  return 0;
+}
+
+int library_scanner::save_cache() {
+  std::string tmp_path =
+      m_cache_path + "." + std::to_string(getpid()) + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cout << "Error writing library cache " << tmp_path << std::endl;
+    return 1;
+  }
+
+  file.write(scan_cache_magic, sizeof(scan_cache_magic));
+  write_value(file, uint32_t(m_scanned.size()));
+  for (const auto &dir : m_scanned) {
+    write_string(file, dir.first);
+    write_value(file, dir.second.mtime);
+    write_value(file, uint32_t(dir.second.subdirs.size()));
+    for (const auto &subdir : dir.second.subdirs) {
+      write_string(file, subdir);
+    }
+    write_value(file, uint32_t(dir.second.files.size()));
+    for (const auto &entry : dir.second.files) {
+      write_string(file, entry.name);
+      write_value(file, entry.size);
+      write_value(file, entry.mtime);
+      write_value(file, entry.inode);
+    }
+  }
+  file.close();
+
+  std::error_code error;
+  if (file.fail()) {
+    std::filesystem::remove(tmp_path, error);
+    return 1;
+  }
+  std::filesystem::rename(tmp_path, m_cache_path, error);
+  return error ? 1 : 0;
+}
+
+// Lists one directory, or reuses the cached listing if the directory has
+// not been modified since, then queues its subdirectories
+void library_scanner::read_directory(const std::string &dir_path) {
+  struct stat dir_stat;
+  if (stat(dir_path.c_str(), &dir_stat) != 0) {
+    return;
+  }
+
+  scan_directory dir;
+  bool reused = false;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto cached = m_cache.find(dir_path);
+    if (cached != m_cache.end() &&
+        cached->second.mtime == get_mtime(dir_stat)) {
+      dir = cached->second;
+      reused = true;
+    }
+  }
+
+  if (!reused) {
+    dir.mtime = get_mtime(dir_stat);
+    DIR *dir_stream = opendir(dir_path.c_str());
+    if (!dir_stream) {
+      return;
+    }
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir_stream)) != nullptr) {
+      std::string name = dir_entry->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      std::string path = dir_path + "/" + name;
+
+      // d_type saves a stat per entry where the filesystem provides it,
+      // symlinked directories aren't followed to avoid loops
+      unsigned char type = dir_entry->d_type;
+      struct stat file_stat;
+      bool have_stat = false;
+      if (type == DT_UNKNOWN) {
+        // lstat so a symlink is still told apart from what it points to
+        if (lstat(path.c_str(), &file_stat) != 0) {
+          continue;
+        }
+        if (S_ISDIR(file_stat.st_mode)) {
+          type = DT_DIR;
+        } else if (S_ISLNK(file_stat.st_mode)) {
+          type = DT_LNK;
+        } else if (S_ISREG(file_stat.st_mode)) {
+          type = DT_REG;
+          have_stat = true;
+        }
+      }
+      if (type == DT_DIR) {
+        dir.subdirs.push_back(name);
+        continue;
+      }
+      if ((type != DT_REG && type != DT_LNK) || !is_track_file(path)) {
+        continue;
+      }
+
+      if (!have_stat && stat(path.c_str(), &file_stat) != 0) {
+        continue;
+      }
+      if (S_ISREG(file_stat.st_mode)) {
+        dir.files.push_back({name, uint64_t(file_stat.st_size),
+                             get_mtime(file_stat), file_stat.st_ino});
+      }
+    }
+    closedir(dir_stream);
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto &subdir : dir.subdirs) {
+    m_queue.push_back(dir_path + "/" + subdir);
+    m_pending++;
+  }
+  if (reused) {
+    m_reused++;
+  }
+  m_scanned[dir_path] = std::move(dir);
+}
+
+void library_scanner::scan_worker() {
+  while (true) {
+    std::string dir_path;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this] { return !m_queue.empty() || m_pending == 0; });
+      if (m_queue.empty()) {
+        return; // nothing queued or being read, scan is finished
+      }
+      dir_path = m_queue.front();
+      m_queue.pop_front();
+    }
+
+    read_directory(dir_path);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending--;
+    }
+    m_cv.notify_all();
+  }
+}
+
+std::vector<std::string> library_scanner::scan(const std::string &root) {
+  std::vector<std::string> paths;
+  std::string root_path = std::filesystem::path(root).lexically_normal();
+  if (root_path.size() > 1 && root_path.back() == '/') {
+    root_path.pop_back();
+  }
+
+  load_cache();
+  m_scanned.clear();
+  m_queue.push_back(root_path);
+  m_pending = 1;
+  m_reused = 0;
+
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread(&library_scanner::scan_worker, this));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &dir : m_scanned) {
+    for (const auto &entry : dir.second.files) {
+      paths.push_back(dir.first + "/" + entry.name);
+    }
+  }
+  // directory read order depends on thread timing
+  std::sort(paths.begin(), paths.end());
+
+  std::cout << "Scanned " << std::to_string(m_scanned.size())
+            << " directories (" << std::to_string(m_reused)
+            << " unchanged), found " << std::to_string(paths.size())
+            << " tracks" << std::endl;
+
+  // directories no longer in the tree drop out of the cache here
+  save_cache();
+  return paths;
+}
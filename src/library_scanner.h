@@ -0,0 +1,49 @@
+#ifndef library_scanner_def
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct scan_entry {
+  std::string name; // file name within its directory
+  uint64_t size;
+  int64_t mtime; // ns since epoch
+  uint64_t inode;
+};
+
+struct scan_directory {
+  int64_t mtime; // ns since epoch, listing is reused while this is unchanged
+  std::vector<std::string> subdirs;
+  std::vector<scan_entry> files;
+};
+
+// Recursive scan of a music library for track files. Directories are read
+// in parallel and their listings kept in a binary cache in
+// $AUTOMIX_HOME/tmp, so a rescan only reads directories that changed.
+class library_scanner {
+private:
+  std::string m_cache_path;
+  std::unordered_map<std::string, scan_directory> m_cache;
+  std::unordered_map<std::string, scan_directory> m_scanned;
+  std::deque<std::string> m_queue;
+  int m_pending; // directories queued or being read
+  int m_reused;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  int load_cache();
+  int save_cache();
+  void scan_worker();
+  void read_directory(const std::string &dir_path);
+
+public:
+  library_scanner(const std::string &cache_path);
+  static bool is_track_file(const std::string &path);
+  std::vector<std::string> scan(const std::string &root);
+};
+
+#define library_scanner_def
+#endif
@@ -0,0 +1,63 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::mapped_file() : m_data(nullptr), m_size(0) {}
+
+mapped_file::~mapped_file() { close(); }
+
+int mapped_file::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cout << "Error opening " << path << " for mapping" << std::endl;
+    return 1;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    std::cout << "Error " << path << " is empty or cannot be stat'd"
+              << std::endl;
+    ::close(fd);
+    return 1;
+  }
+
+  void *data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // mapping keeps its own reference to the file
+
+  if (data == MAP_FAILED) {
+    std::cout << "Error mapping " << path << std::endl;
+    return 1;
+  }
+
+  m_data = data;
+  m_size = file_stat.st_size;
+  return 0;
+}
+
+void mapped_file::close() {
+  if (m_data) {
+    munmap(m_data, m_size);
+  }
+  m_data = nullptr;
+  m_size = 0;
+}
+
+void mapped_file::advise(int advice) {
+  if (m_data) {
+    madvise(m_data, m_size, advice);
+  }
+}
+
+bool mapped_file::is_open() { return m_data != nullptr; }
+
+const unsigned char *mapped_file::data() {
+  return static_cast<const unsigned char *>(m_data);
+}
+
+size_t mapped_file::size() { return m_size; }
@@ -0,0 +1,26 @@
+#ifndef mapped_file_def
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class mapped_file {
+private:
+  void *m_data;
+  size_t m_size;
+
+public:
+  mapped_file();
+  ~mapped_file();
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+  int open(const std::string &path);
+  void close();
+  void advise(int advice);
+  bool is_open();
+  const unsigned char *data();
+  size_t size();
+};
+
+#define mapped_file_def
+#endif
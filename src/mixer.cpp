@@ -19,12 +19,13 @@ int mixer::read(float *data_ptr, int num_samples) {
   int all_paused = 1;
   std::vector<int> read_sizes;
   std::vector<action_t> step_actions;
-  double step_time = (m_time / (2 * 44100));
+  double step_time = (m_time / (2 * engine_sample_rate));
 
   while (m_actions.size() > 0 &&
-         m_actions.front().time <= (m_time + num_samples) / (2 * 44100)) {
+         m_actions.front().time <=
+             (m_time + num_samples) / (2 * engine_sample_rate)) {
     action_t action = m_actions.front();
-    read_sizes.push_back((action.time - step_time) * 2 * 44100);
+    read_sizes.push_back((action.time - step_time) * 2 * engine_sample_rate);
     step_actions.push_back(action);
     step_time = action.time;
     m_actions.pop_front();
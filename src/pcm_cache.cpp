@@ -0,0 +1,230 @@
+#include "pcm_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const char cache_magic[8] = {'A', 'M', 'X', 'P', 'C', 'M', '0', '1'};
+static const char *cache_extension = ".pcm";
+
+std::string pcm_cache::s_dir;
+uint64_t pcm_cache::s_budget = 0;
+std::mutex pcm_cache::s_mutex;
+
+int pcm_cache::configure(const std::string &dir, uint64_t budget_bytes) {
+  s_dir = dir;
+  s_budget = budget_bytes;
+  if (s_budget == 0) {
+    return 0;
+  }
+
+  std::error_code error;
+  std::filesystem::create_directories(s_dir, error);
+  if (error) {
+    std::cout << "Error creating PCM cache directory " << s_dir
+              << ", disabling cache" << std::endl;
+    s_budget = 0;
+    return 1;
+  }
+
+  // remove entries left half written by a previous run
+  auto stale_time =
+      std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+  for (const auto &entry : std::filesystem::directory_iterator(s_dir)) {
+    if (entry.path().extension() == ".tmp" &&
+        entry.last_write_time() < stale_time) {
+      std::filesystem::remove(entry.path(), error);
+    }
+  }
+
+  evict("");
+  return 0;
+}
+
+bool pcm_cache::enabled() { return s_budget > 0; }
+
+uint64_t pcm_cache::get_budget() { return s_budget; }
+
+int pcm_cache::get_entry(const std::string &source_path,
+                         std::string &entry_path, pcm_cache_header &header) {
+  struct stat source_stat;
+  if (stat(source_path.c_str(), &source_stat) != 0) {
+    return 1;
+  }
+
+  memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.sample_rate = engine_sample_rate;
+  header.channels = engine_channels;
+  header.source_size = source_stat.st_size;
+  header.source_mtime = int64_t(source_stat.st_mtim.tv_sec) * 1000000000 +
+                        source_stat.st_mtim.tv_nsec;
+  header.num_samples = 0;
+
+  std::stringstream key;
+  key << source_path << "|" << header.source_size << "|"
+      << header.source_mtime;
+  std::stringstream name;
+  name << std::hex << std::hash<std::string>{}(key.str()) << cache_extension;
+  entry_path = s_dir + "/" + name.str();
+  return 0;
+}
+
+int pcm_cache::open(const std::string &source_path, mapped_file &map,
+                    const float *&samples, size_t &num_samples) {
+  if (!enabled()) {
+    return 1;
+  }
+
+  std::string entry_path;
+  pcm_cache_header expected;
+  if (get_entry(source_path, entry_path, expected) != 0 ||
+      !std::filesystem::is_regular_file(entry_path)) {
+    return 1;
+  }
+
+  if (map.open(entry_path) != 0 || map.size() < sizeof(pcm_cache_header)) {
+    map.close();
+    return 1;
+  }
+
+  pcm_cache_header header;
+  memcpy(&header, map.data(), sizeof(header));
+  if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+      header.sample_rate != expected.sample_rate ||
+      header.channels != expected.channels ||
+      header.source_size != expected.source_size ||
+      header.source_mtime != expected.source_mtime ||
+      map.size() != sizeof(header) + header.num_samples * sizeof(float)) {
+    std::cout << "Discarding invalid PCM cache entry " << entry_path
+              << std::endl;
+    map.close();
+    std::error_code error;
+    std::filesystem::remove(entry_path, error);
+    return 1;
+  }
+
+  map.advise(MADV_SEQUENTIAL);
+  samples = reinterpret_cast<const float *>(map.data() + sizeof(header));
+  num_samples = header.num_samples;
+
+  // mark as most recently used
+  std::error_code error;
+  std::filesystem::last_write_time(
+      entry_path, std::filesystem::file_time_type::clock::now(), error);
+  return 0;
+}
+
+void pcm_cache::evict(const std::string &keep_path) {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  std::vector<std::pair<std::filesystem::file_time_type,
+                        std::filesystem::directory_entry>>
+      entries;
+  uint64_t total = 0;
+  std::error_code error;
+
+  for (const auto &entry : std::filesystem::directory_iterator(s_dir, error)) {
+    if (entry.path().extension() == cache_extension) {
+      total += entry.file_size(error);
+      if (entry.path() != keep_path) {
+        entries.push_back(std::make_pair(entry.last_write_time(error), entry));
+      }
+    }
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  for (auto &entry : entries) {
+    if (total <= s_budget) {
+      break;
+    }
+    uint64_t size = entry.second.file_size(error);
+    std::cout << "Evicting PCM cache entry " << entry.second.path()
+              << std::endl;
+    if (std::filesystem::remove(entry.second.path(), error)) {
+      total -= size;
+    }
+  }
+}
+
+pcm_cache_writer::~pcm_cache_writer() { abort(); }
+
+int pcm_cache_writer::begin(const std::string &source_path) {
+  static std::atomic<int> writer_count(0);
+
+  abort();
+  if (!pcm_cache::enabled() ||
+      pcm_cache::get_entry(source_path, m_entry_path, m_header) != 0) {
+    return 1;
+  }
+
+  m_tmp_path = m_entry_path + "." + std::to_string(getpid()) + "." +
+               std::to_string(writer_count++) + ".tmp";
+  m_file.open(m_tmp_path, std::ios::binary | std::ios::trunc);
+  if (!m_file.is_open()) {
+    std::cout << "Error opening PCM cache file " << m_tmp_path << std::endl;
+    return 1;
+  }
+  m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+  return 0;
+}
+
+void pcm_cache_writer::write(const float *samples, int num_samples) {
+  if (!m_file.is_open()) {
+    return;
+  }
+  m_file.write(reinterpret_cast<const char *>(samples),
+               num_samples * sizeof(float));
+  m_header.num_samples += num_samples;
+  if ((sizeof(m_header) + m_header.num_samples * sizeof(float)) >
+      pcm_cache::get_budget()) {
+    abort(); // would evict everything else, not worth keeping
+  }
+}
+
+int pcm_cache_writer::commit() {
+  if (!m_file.is_open()) {
+    return 1;
+  }
+  m_file.seekp(0);
+  m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header));
+  m_file.close();
+
+  if (m_file.fail()) {
+    std::cout << "Error writing PCM cache file " << m_tmp_path << std::endl;
+    abort();
+    return 1;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(m_tmp_path, m_entry_path, error);
+  if (error) {
+    abort();
+    return 1;
+  }
+  m_tmp_path.clear();
+  pcm_cache::evict(m_entry_path);
+  return 0;
+}
+
+void pcm_cache_writer::abort() {
+  if (m_file.is_open()) {
+    m_file.close();
+  }
+  if (!m_tmp_path.empty()) {
+    std::error_code error;
+    std::filesystem::remove(m_tmp_path, error);
+    m_tmp_path.clear();
+  }
+}
+
+bool pcm_cache_writer::active() { return m_file.is_open(); }
+
+uint64_t pcm_cache_writer::get_num_samples() { return m_header.num_samples; }
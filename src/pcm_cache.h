@@ -0,0 +1,59 @@
+#ifndef pcm_cache_def
+
+#include "engine.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// Decoded tracks are cached as interleaved float32 PCM in
+// $AUTOMIX_HOME/tmp/pcm, one file per source keyed by path, size and mtime.
+// File modification time doubles as last use time for LRU eviction.
+
+struct pcm_cache_header {
+  char magic[8];
+  uint32_t sample_rate;
+  uint32_t channels;
+  uint64_t source_size;
+  int64_t source_mtime; // ns since epoch
+  uint64_t num_samples; // interleaved samples following the header
+};
+
+class pcm_cache_writer {
+private:
+  std::ofstream m_file;
+  std::string m_tmp_path;
+  std::string m_entry_path;
+  pcm_cache_header m_header;
+
+public:
+  ~pcm_cache_writer();
+  int begin(const std::string &source_path);
+  void write(const float *samples, int num_samples);
+  int commit();
+  void abort();
+  bool active();
+  uint64_t get_num_samples();
+};
+
+class pcm_cache {
+private:
+  static std::string s_dir;
+  static uint64_t s_budget;
+  static std::mutex s_mutex;
+
+public:
+  static int configure(const std::string &dir, uint64_t budget_bytes);
+  static bool enabled();
+  static uint64_t get_budget();
+  static int get_entry(const std::string &source_path, std::string &entry_path,
+                       pcm_cache_header &header);
+  static int open(const std::string &source_path, mapped_file &map,
+                  const float *&samples, size_t &num_samples);
+  static void evict(const std::string &keep_path);
+};
+
+#define pcm_cache_def
+#endif
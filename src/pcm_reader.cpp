@@ -0,0 +1,341 @@
+#include "pcm_reader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sys/mman.h>
+
+// Sample loaders, memcpy keeps unaligned loads legal and still compiles to
+// a plain load so the conversion loops below vectorize
+static inline float load_s16le(const unsigned char *p) {
+  int16_t value;
+  memcpy(&value, p, 2);
+  return value * (1.0f / 32768.0f);
+}
+
+static inline float load_s16be(const unsigned char *p) {
+  uint16_t value;
+  memcpy(&value, p, 2);
+  return int16_t(__builtin_bswap16(value)) * (1.0f / 32768.0f);
+}
+
+static inline float load_s24le(const unsigned char *p) {
+  int32_t value =
+      int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24);
+  return (value >> 8) * (1.0f / 8388608.0f);
+}
+
+static inline float load_s24be(const unsigned char *p) {
+  int32_t value =
+      int32_t(uint32_t(p[2]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[0]) << 24);
+  return (value >> 8) * (1.0f / 8388608.0f);
+}
+
+static inline float load_s32le(const unsigned char *p) {
+  int32_t value;
+  memcpy(&value, p, 4);
+  return value * (1.0f / 2147483648.0f);
+}
+
+static inline float load_s32be(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return int32_t(__builtin_bswap32(value)) * (1.0f / 2147483648.0f);
+}
+
+static inline float load_f32le(const unsigned char *p) {
+  float value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+static inline float load_f32be(const unsigned char *p) {
+  uint32_t bits;
+  float value;
+  memcpy(&bits, p, 4);
+  bits = __builtin_bswap32(bits);
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+// Converts frames to interleaved stereo, the stereo case is a flat loop
+// over samples
+template <int bytes, float (*load)(const unsigned char *)>
+static void convert_frames(const unsigned char *input, int channels,
+                           float *output, size_t frames) {
+  if (channels == 2) {
+    for (size_t i = 0; i < frames * 2; i++) {
+      output[i] = load(input + i * bytes);
+    }
+  } else if (channels == 1) {
+    for (size_t i = 0; i < frames; i++) {
+      float sample = load(input + i * bytes);
+      output[i * 2] = sample;
+      output[i * 2 + 1] = sample;
+    }
+  } else {
+    size_t stride = size_t(channels) * bytes;
+    for (size_t i = 0; i < frames; i++) {
+      output[i * 2] = load(input + i * stride);
+      output[i * 2 + 1] = load(input + i * stride + bytes);
+    }
+  }
+}
+
+static uint32_t read_le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+
+static uint32_t read_le32(const unsigned char *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+
+static uint32_t read_be16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+
+static uint32_t read_be32(const unsigned char *p) {
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 |
+         uint32_t(p[3]);
+}
+
+// AIFF stores the sample rate as an 80 bit extended float
+static double read_extended(const unsigned char *p) {
+  int exponent = ((p[0] & 0x7f) << 8) | p[1];
+  uint64_t mantissa = 0;
+  for (int i = 2; i < 10; i++) {
+    mantissa = (mantissa << 8) | p[i];
+  }
+  if (exponent == 0 && mantissa == 0) {
+    return 0;
+  }
+  double value = ldexp(double(mantissa), exponent - 16383 - 63);
+  return (p[0] & 0x80) ? -value : value;
+}
+
+pcm_reader::pcm_reader()
+    : m_data(nullptr), m_num_frames(0), m_frame_pos(0), m_sample_rate(0),
+      m_channels(0), m_bytes_per_sample(0), m_encoding(PCM_INT16),
+      m_big_endian(false) {}
+
+bool pcm_reader::is_pcm_file(const std::string &path) {
+  std::string extension = std::filesystem::path(path).extension();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  return extension == ".wav" || extension == ".aif" || extension == ".aiff";
+}
+
+int pcm_reader::set_encoding(int bits, bool is_float) {
+  m_bytes_per_sample = (bits + 7) / 8;
+  if (is_float) {
+    if (bits != 32) {
+      return 1;
+    }
+    m_encoding = PCM_FLOAT32;
+  } else if (m_bytes_per_sample == 2) {
+    m_encoding = PCM_INT16;
+  } else if (m_bytes_per_sample == 3) {
+    m_encoding = PCM_INT24;
+  } else if (m_bytes_per_sample == 4) {
+    m_encoding = PCM_INT32;
+  } else {
+    return 1; // 8 bit, leave it to FFmpeg
+  }
+  return 0;
+}
+
+int pcm_reader::parse_wav() {
+  const unsigned char *file = m_map.data();
+  size_t size = m_map.size();
+  bool have_format = false;
+
+  if (size < 12 || memcmp(file + 8, "WAVE", 4) != 0) {
+    return 1;
+  }
+
+  m_big_endian = false;
+  size_t pos = 12;
+  while (pos + 8 <= size) {
+    const unsigned char *chunk = file + pos;
+    const unsigned char *body = chunk + 8;
+    size_t chunk_size = read_le32(chunk + 4);
+    size_t available = size - pos - 8;
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      if (chunk_size < 16 || chunk_size > available) {
+        return 1;
+      }
+      int format = read_le16(body);
+      m_channels = read_le16(body + 2);
+      m_sample_rate = read_le32(body + 4);
+      int block_align = read_le16(body + 12);
+      int bits = read_le16(body + 14);
+      if (format == 0xFFFE && chunk_size >= 40) {
+        format = read_le16(body + 24); // WAVE_FORMAT_EXTENSIBLE sub format
+      }
+      if ((format != 1 && format != 3) || m_channels == 0 ||
+          set_encoding(bits, format == 3) != 0 ||
+          block_align != m_channels * m_bytes_per_sample) {
+        return 1;
+      }
+      have_format = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!have_format) {
+        return 1;
+      }
+      // streamed files can leave the size unset, trust the file length
+      m_data = body;
+      m_num_frames = std::min(chunk_size, available) /
+                     (m_channels * m_bytes_per_sample);
+      return 0;
+    }
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+  return 1;
+}
+
+int pcm_reader::parse_aiff() {
+  const unsigned char *file = m_map.data();
+  size_t size = m_map.size();
+  bool have_format = false;
+  const unsigned char *sound_data = nullptr;
+  size_t sound_bytes = 0;
+  size_t frames = 0;
+
+  if (size < 12 ||
+      (memcmp(file + 8, "AIFF", 4) != 0 && memcmp(file + 8, "AIFC", 4) != 0)) {
+    return 1;
+  }
+  bool compressed = file[11] == 'C';
+
+  size_t pos = 12;
+  while (pos + 8 <= size) {
+    const unsigned char *chunk = file + pos;
+    const unsigned char *body = chunk + 8;
+    size_t chunk_size = read_be32(chunk + 4);
+    size_t available = size - pos - 8;
+
+    if (memcmp(chunk, "COMM", 4) == 0) {
+      if (chunk_size < 18 || chunk_size > available) {
+        return 1;
+      }
+      m_channels = read_be16(body);
+      frames = read_be32(body + 2);
+      int bits = read_be16(body + 6);
+      m_sample_rate = int(lround(read_extended(body + 8)));
+      bool is_float = false;
+      m_big_endian = true;
+      if (compressed && chunk_size >= 22) {
+        const unsigned char *type = body + 18;
+        if (memcmp(type, "sowt", 4) == 0) {
+          m_big_endian = false;
+        } else if (memcmp(type, "fl32", 4) == 0 ||
+                   memcmp(type, "FL32", 4) == 0) {
+          is_float = true;
+        } else if (memcmp(type, "NONE", 4) != 0 &&
+                   memcmp(type, "twos", 4) != 0) {
+          return 1;
+        }
+      }
+      if (m_channels == 0 || set_encoding(bits, is_float) != 0) {
+        return 1;
+      }
+      have_format = true;
+    } else if (memcmp(chunk, "SSND", 4) == 0) {
+      size_t length = std::min(chunk_size, available);
+      if (length < 8 || read_be32(body) > length - 8) {
+        return 1;
+      }
+      sound_data = body + 8 + read_be32(body);
+      sound_bytes = length - 8 - read_be32(body);
+    }
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  // COMM may come after SSND so only finish once both are found
+  if (!have_format || !sound_data) {
+    return 1;
+  }
+  m_data = sound_data;
+  m_num_frames =
+      std::min(frames, sound_bytes / (m_channels * m_bytes_per_sample));
+  return 0;
+}
+
+int pcm_reader::open(const std::string &path) {
+  close();
+  if (m_map.open(path) != 0) {
+    return 1;
+  }
+
+  int error = 1;
+  if (m_map.size() >= 4 && memcmp(m_map.data(), "RIFF", 4) == 0) {
+    error = parse_wav();
+  } else if (m_map.size() >= 4 && memcmp(m_map.data(), "FORM", 4) == 0) {
+    error = parse_aiff();
+  }
+
+  if (error != 0) {
+    std::cout << path << ": Not a supported PCM file" << std::endl;
+    close();
+    return 1;
+  }
+
+  m_map.advise(MADV_SEQUENTIAL);
+  std::cout << path << ": Reading PCM directly, "
+            << std::to_string(m_bytes_per_sample * 8) << " bit "
+            << (m_encoding == PCM_FLOAT32 ? "float" : "integer") << ", "
+            << std::to_string(m_channels) << " channels, "
+            << std::to_string(m_sample_rate) << " Hz" << std::endl;
+  return 0;
+}
+
+void pcm_reader::close() {
+  m_map.close();
+  m_data = nullptr;
+  m_num_frames = 0;
+  m_frame_pos = 0;
+}
+
+bool pcm_reader::is_open() { return m_data != nullptr; }
+
+// Reads interleaved stereo samples, fewer than asked for at the end
+int pcm_reader::read(float *data_ptr, int num_samples) {
+  if (!m_data) {
+    return 0;
+  }
+  size_t frames =
+      std::min(size_t(num_samples / 2), m_num_frames - m_frame_pos);
+
+  const unsigned char *input =
+      m_data + m_frame_pos * m_channels * m_bytes_per_sample;
+  switch (m_encoding) {
+  case PCM_INT16:
+    m_big_endian
+        ? convert_frames<2, load_s16be>(input, m_channels, data_ptr, frames)
+        : convert_frames<2, load_s16le>(input, m_channels, data_ptr, frames);
+    break;
+  case PCM_INT24:
+    m_big_endian
+        ? convert_frames<3, load_s24be>(input, m_channels, data_ptr, frames)
+        : convert_frames<3, load_s24le>(input, m_channels, data_ptr, frames);
+    break;
+  case PCM_INT32:
+    m_big_endian
+        ? convert_frames<4, load_s32be>(input, m_channels, data_ptr, frames)
+        : convert_frames<4, load_s32le>(input, m_channels, data_ptr, frames);
+    break;
+  case PCM_FLOAT32:
+    m_big_endian
+        ? convert_frames<4, load_f32be>(input, m_channels, data_ptr, frames)
+        : convert_frames<4, load_f32le>(input, m_channels, data_ptr, frames);
+    break;
+  }
+
+  m_frame_pos += frames;
+  return frames * 2;
+}
+
+int pcm_reader::get_sample_rate() { return m_sample_rate; }
+
+size_t pcm_reader::get_num_samples() { return m_num_frames * 2; }
@@ -0,0 +1,46 @@
+#ifndef pcm_reader_def
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <string>
+
+typedef enum {
+  PCM_INT16,
+  PCM_INT24,
+  PCM_INT32,
+  PCM_FLOAT32,
+} pcm_encoding_t;
+
+// Reads uncompressed WAV and AIFF files straight out of a mapping of the
+// file, converting to interleaved stereo float without going through
+// libavcodec. Mono is duplicated to both channels, anything above two
+// channels only keeps the first two.
+class pcm_reader {
+private:
+  mapped_file m_map;
+  const unsigned char *m_data; // first sample frame in the mapping
+  size_t m_num_frames;
+  size_t m_frame_pos;
+  int m_sample_rate;
+  int m_channels;
+  int m_bytes_per_sample;
+  pcm_encoding_t m_encoding;
+  bool m_big_endian;
+  int parse_wav();
+  int parse_aiff();
+  int set_encoding(int bits, bool is_float);
+
+public:
+  pcm_reader();
+  static bool is_pcm_file(const std::string &path);
+  int open(const std::string &path);
+  void close();
+  bool is_open();
+  int read(float *data_ptr, int num_samples);
+  int get_sample_rate();
+  size_t get_num_samples();
+};
+
+#define pcm_reader_def
+#endif
@@ -16,6 +16,10 @@
                                    - remove old beat track method
                                    - pass through step division and allow smaller step sizes
                                    - rename class
+                                   - take a shared magnitude spectrum
+                                   - native frame interface for detector_pipeline
+                                   - expose the detection function for other tempo estimators
+                                   - reset keeps the detection function
 */                              
 
 #include "beat_track.h"
@@ -39,21 +43,22 @@ float beat_tracker::m_stepSecs = 0.01161; // 512 samples at 44100
 class beat_trackerData
 {
 public:
-    beat_trackerData(const DFConfig &config) : dfConfig(config) {
+    beat_trackerData(const DFConfig &config) :
+        dfConfig(config), frame(config.frameLength) {
     df = new detection_function(config);
     }
     ~beat_trackerData() {
     delete df;
     }
     void reset() {
-    delete df;
-    df = new detection_function(dfConfig);
-    dfOutput.clear();
+    df->reset();
+    dfOutput.clear(); // keeps its capacity for the next input
         origin = Vamp::RealTime::zeroTime;
     }
 
     DFConfig dfConfig;
     detection_function *df;
+    vector<double> frame; // double copy of the input frame
     vector<double> dfOutput;
     Vamp::RealTime origin;
 };
@@ -375,24 +380,13 @@ beat_tracker::process(const float *const *inputBuffers,
 
     size_t len = m_d->dfConfig.frameLength;
 
-    double *samples_copy = new double[len];
-    // double *imags = new double[len];
-
     // // We only support a single input channel
 
     for (size_t i = 0; i < len; ++i) {
-        samples_copy[i] = inputBuffers[0][i];
+        m_d->frame[i] = inputBuffers[0][i];
     }
-    // std::cout << "df_input sample: " << std::to_string(samples_copy[0]) << std::endl;
-
-    // double output = m_d->df->processFrequencyDomain(reals, imags);
 
-    double output = m_d->df->processTimeDomain(samples_copy);
-
-    delete[] samples_copy;
-    // delete[] imags;
-
-    // std::cout << "Output: " << std::to_string(output) << std::endl;
+    double output = m_d->df->processTimeDomain(m_d->frame.data());
 
     if (m_d->dfOutput.empty()) m_d->origin = timestamp;
 
@@ -408,6 +402,103 @@ beat_tracker::process(const float *const *inputBuffers,
     return returnFeatures;
 }
 
+void
+beat_tracker::process_frame(const float *frame, long position)
+{
+    if (!m_d) {
+    cerr << "ERROR: beat_tracker::process_frame: "
+         << "beat_tracker has not been initialised"
+         << endl;
+    return;
+    }
+
+    size_t len = m_d->dfConfig.frameLength;
+    for (size_t i = 0; i < len; ++i) {
+        m_d->frame[i] = frame[i];
+    }
+
+    add_output(m_d->df->processTimeDomain(m_d->frame.data()), position);
+}
+
+void
+beat_tracker::process_spectrum(const double *magnitude, long position)
+{
+    if (!m_d) {
+    cerr << "ERROR: beat_tracker::process_spectrum: "
+         << "beat_tracker has not been initialised"
+         << endl;
+    return;
+    }
+
+    add_output(m_d->df->processMagnitude(magnitude), position);
+}
+
+void
+beat_tracker::add_output(double output, long position)
+{
+    if (m_d->dfOutput.empty()) {
+        m_d->origin = Vamp::RealTime::frame2RealTime
+            (position, lrintf(m_inputSampleRate));
+    }
+    m_d->dfOutput.push_back(output);
+}
+
+void
+beat_tracker::reserve_frames(size_t frames)
+{
+    if (m_d) m_d->dfOutput.reserve(frames);
+}
+
+bool
+beat_tracker::uses_magnitude_only() const
+{
+    return m_d && m_d->df->magnitudeOnly();
+}
+
+void
+beat_tracker::clear_frames()
+{
+    if (m_d) m_d->dfOutput.clear();
+}
+
+void
+beat_tracker::append_frames(const beat_tracker &chunk)
+{
+    if (!m_d || !chunk.m_d) return;
+    if (m_d->dfOutput.empty()) m_d->origin = chunk.m_d->origin;
+    m_d->dfOutput.insert(m_d->dfOutput.end(),
+                         chunk.m_d->dfOutput.begin(),
+                         chunk.m_d->dfOutput.end());
+}
+
+void
+beat_tracker::get_detection_function(vector<double> &df) const
+{
+    df.clear();
+    if (!m_d) return;
+
+    size_t nonZeroCount = m_d->dfOutput.size();
+    while (nonZeroCount > 0) {
+        if (m_d->dfOutput[nonZeroCount-1] > 0.0) {
+            break;
+        }
+        --nonZeroCount;
+    }
+
+//    std::cerr << "Note: nonZeroCount was " << m_d->dfOutput.size() << ", is now " << nonZeroCount << std::endl;
+
+    for (size_t i = 2; i < nonZeroCount; ++i) { // discard first two elts
+        df.push_back(m_d->dfOutput[i]);
+    }
+}
+
+double
+beat_tracker::get_origin() const
+{
+    if (!m_d) return 0;
+    return m_d->origin.sec + double(m_d->origin.nsec) / 1000000000;
+}
+
 beat_tracker::FeatureSet
 beat_tracker::getRemainingFeatures()
 {
@@ -506,24 +597,11 @@ beat_tracker::FeatureSet
 beat_tracker::beatTrackNew()
 {
     vector<double> df;
-    vector<double> beatPeriod;
     vector<double> tempi;
     // std::cout << std::to_string(m_d->dfOutput.size()) << " df size" << std::endl;
     // std::for_each(m_d->dfOutput.begin(), m_d->dfOutput.end(), [](double &n){ std::cout<<std::to_string(n) << std::endl; });
-    size_t nonZeroCount = m_d->dfOutput.size();
-    while (nonZeroCount > 0) {
-        if (m_d->dfOutput[nonZeroCount-1] > 0.0) {
-            break;
-        }
-        --nonZeroCount;
-    }
-
-//    std::cerr << "Note: nonZeroCount was " << m_d->dfOutput.size() << ", is now " << nonZeroCount << std::endl;
-
-    for (size_t i = 2; i < nonZeroCount; ++i) { // discard first two elts
-        df.push_back(m_d->dfOutput[i]);
-        beatPeriod.push_back(0.0);
-    }
+    get_detection_function(df);
+    vector<double> beatPeriod(df.size(), 0.0);
     if (df.empty()) return FeatureSet();
 
     tempo_track tt(m_inputSampleRate, m_d->dfConfig.stepSize, m_div);
@@ -14,6 +14,9 @@
 
 /* Edited @Matthew Walker 01/01/21 - add m_div
                                    - rename class
+                                   - take a shared magnitude spectrum
+                                   - native frame interface for detector_pipeline
+                                   - expose the detection function for other tempo estimators
 */    
 
 #ifndef _BEAT_TRACK_PLUGIN_H_
@@ -53,6 +56,24 @@ public:
     FeatureSet process(const float *const *inputBuffers,
                        Vamp::RealTime timestamp);
 
+    // Native interface used by the analyzer, position is the frame start
+    // in samples. process_spectrum takes a spectrum computed elsewhere, only
+    // when uses_magnitude_only()
+    void process_frame(const float *frame, long position);
+    void process_spectrum(const double *magnitude, long position);
+    bool uses_magnitude_only() const;
+    void reserve_frames(size_t frames);
+
+    // For analysing a track in chunks, clear drops the outputs so far but
+    // keeps the detection function state, append adds a later chunk's
+    void clear_frames();
+    void append_frames(const beat_tracker &chunk);
+
+    // The detection function as the tempo tracker sees it, frame i is at
+    // get_origin() + i steps in seconds as are the beats it outputs
+    void get_detection_function(std::vector<double> &df) const;
+    double get_origin() const;
+
     FeatureSet getRemainingFeatures();
 
 protected:
@@ -71,6 +92,7 @@ protected:
     static float m_stepSecs;
     FeatureSet beatTrackOld();
     FeatureSet beatTrackNew();
+    void add_output(double output, long position);
 };
 
 
@@ -15,10 +15,14 @@
 
 /* Edited @Matthew Walker 01/01/21 - broadband df add threshold value
                                    - rename class
-
+                                   - process precomputed magnitudes
+                                   - magnitude only transform, float broadband
+                                   - reset without reallocating
 */
 
 #include "qm/detection_function.h"
+#include <algorithm>
+#include <cfloat>
 #include <cstring>
 #include <csignal>
 
@@ -33,6 +37,10 @@ detection_function::detection_function( DFConfig Config ) :
     m_phaseHistory = NULL;
     m_phaseHistoryOld = NULL;
     m_magPeaks = NULL;
+    m_powerHistory = NULL;
+    m_fft = NULL;
+    m_real = NULL;
+    m_imag = NULL;
     initialise( Config );
 }
 
@@ -50,6 +58,7 @@ void detection_function::initialise( DFConfig Config )
     m_DFType = Config.DFType;
     m_stepSize = Config.stepSize;
     m_dbRise = Config.dbRise;
+    m_riseRatio = float(pow(10.0, m_dbRise / 10.0));
 
     m_whiten = Config.adaptiveWhitening;
     m_whitenRelaxCoeff = Config.whiteningRelaxCoeff;
@@ -69,7 +78,15 @@ void detection_function::initialise( DFConfig Config )
     m_magPeaks = new double[ m_halfLength ];
     memset(m_magPeaks,0, m_halfLength*sizeof(double));
 
+    m_powerHistory = new float[ m_halfLength ];
+    memset(m_powerHistory,0, m_halfLength*sizeof(float));
+
     m_phaseVoc = new PhaseVocoder(m_dataLength, m_stepSize);
+    if (magnitudeOnly()) {
+        m_fft = new FFTReal(m_dataLength);
+        m_real = new double[ m_dataLength ];
+        m_imag = new double[ m_dataLength ];
+    }
 
     m_magnitude = new double[ m_halfLength ];
     m_thetaAngle = new double[ m_halfLength ];
@@ -85,8 +102,12 @@ void detection_function::deInitialise()
     delete [] m_phaseHistory ;
     delete [] m_phaseHistoryOld ;
     delete [] m_magPeaks ;
+    delete [] m_powerHistory ;
 
     delete m_phaseVoc;
+    delete m_fft;
+    delete [] m_real;
+    delete [] m_imag;
 
     delete [] m_magnitude;
     delete [] m_thetaAngle;
@@ -96,12 +117,26 @@ void detection_function::deInitialise()
     delete m_window;
 }
 
+void detection_function::reset()
+{
+    memset(m_magHistory, 0, m_halfLength*sizeof(double));
+    memset(m_phaseHistory, 0, m_halfLength*sizeof(double));
+    memset(m_phaseHistoryOld, 0, m_halfLength*sizeof(double));
+    memset(m_magPeaks, 0, m_halfLength*sizeof(double));
+    memset(m_powerHistory, 0, m_halfLength*sizeof(float));
+    m_phaseVoc->reset();
+}
+
 double detection_function::processTimeDomain(const double *samples)
 {
     m_window->cut(samples, m_windowed);
 
-    m_phaseVoc->processTimeDomain(m_windowed, 
-                                  m_magnitude, m_thetaAngle, m_unwrapped);
+    if (m_fft) {
+        magnitudeTransform();
+    } else {
+        m_phaseVoc->processTimeDomain(m_windowed,
+                                      m_magnitude, m_thetaAngle, m_unwrapped);
+    }
 
     if (m_whiten) whiten();
 
@@ -119,6 +154,39 @@ double detection_function::processFrequencyDomain(const double *reals,
     return runDF();
 }
 
+double detection_function::processMagnitude(const double *magnitude)
+{
+    memcpy(m_magnitude, magnitude, m_halfLength*sizeof(double));
+
+    if (m_whiten) whiten();
+
+    return runDF();
+}
+
+bool detection_function::magnitudeOnly() const
+{
+    return m_DFType == DF_HFC || m_DFType == DF_SPECDIFF ||
+        m_DFType == DF_BROADBAND;
+}
+
+// The phase vocoder's transform without the phase and unwrapping, the
+// halves are swapped the same way so the magnitudes are identical
+void detection_function::magnitudeTransform()
+{
+    unsigned int half = m_dataLength/2;
+    for (unsigned int i = 0; i < half; ++i) {
+        double tmp = m_windowed[i];
+        m_windowed[i] = m_windowed[i + half];
+        m_windowed[i + half] = tmp;
+    }
+
+    m_fft->forward(m_windowed, m_real, m_imag);
+
+    for (unsigned int i = 0; i < m_halfLength; ++i) {
+        m_magnitude[i] = sqrt(m_real[i] * m_real[i] + m_imag[i] * m_imag[i]);
+    }
+}
+
 void detection_function::whiten()
 {
     for (unsigned int i = 0; i < m_halfLength; ++i) {
@@ -270,28 +338,28 @@ double detection_function::complexSD(unsigned int length, double *srcMagnitude,
     return val;
 }
 
+// 10*log10(sqrmag/history) > dbRise is tested as sqrmag > history*10^(dbRise/10)
+// so there is no log per bin, branch free in float so it vectorizes. The
+// 0.001 floors are as before, a zero history with a zero bin still counts
+// as a rise (the log was of infinity)
 double detection_function::broadband(unsigned int length, double *src)
 {
-    double val = 0;
     if (src[0] < 0.001) {    // get rid of erroneous onset at start of track (I hope)
-        return val;
+        return 0;
     }
+    float *history = m_powerHistory;
+    float ratio = m_riseRatio;
+    int count = 0;
     for (unsigned int i = 0; i < length; ++i) {
-        double sqrmag = src[i] * src[i];
-        // if (m_magHistory[i] > 0.0 && sqrmag > 0.0) {
-        if (sqrmag <= 0.0) {
-            sqrmag = 0.001;
-        } else if (m_magHistory[i] <= 0.0) {
-            m_magHistory[i] = 0.001;
-         }
-
-        double diff = 10.0 * log10(sqrmag / m_magHistory[i]);
-        if (diff > m_dbRise) val = val + 1;
-        // }
-        m_magHistory[i] = sqrmag;
+        double power = src[i] * src[i];
+        bool silent = !(power > 0.0);
+        float prev = (!silent && history[i] <= 0.0f) ? 0.001f : history[i];
+        float sqrmag = silent ? 0.001f : std::max(float(power), FLT_MIN);
+        count += sqrmag > prev * ratio;
+        history[i] = sqrmag;
     }
 
-    return val;
+    return count;
 }        
 
 double* detection_function::getSpectrumMagnitude()
@@ -14,6 +14,9 @@
 */
 
 /* Edited @Matthew Walker 01/01/21 - rename class
+                                   - process precomputed magnitudes
+                                   - magnitude only transform, float broadband
+                                   - reset without reallocating
 */    
 
 #ifndef DETECTIONFUNCTION_H
@@ -23,6 +26,7 @@
 #include "maths/MathAliases.h"
 #include "dsp/phasevocoder/PhaseVocoder.h"
 #include "base/Window.h"
+#include "dsp/transforms/FFT.h"
 
 #define DF_HFC (1)
 #define DF_SPECDIFF (2)
@@ -59,6 +63,23 @@ public:
      */
     double processFrequencyDomain(const double* reals, const double* imags);
 
+    /**
+     * Process a single frame given as frameLength/2+1 magnitudes of the
+     * Hann windowed, FFT shifted frame. Only valid when magnitudeOnly().
+     */
+    double processMagnitude(const double* magnitude);
+
+    /**
+     * True if the detection function type doesn't need the phase.
+     */
+    bool magnitudeOnly() const;
+
+    /**
+     * Clear the frame history for a new input, keeping the buffers and
+     * transforms of the same configuration.
+     */
+    void reset();
+
 private:
     void whiten();
     double runDF();
@@ -68,6 +89,7 @@ private:
     double phaseDev(unsigned int length, double *srcPhase);
     double complexSD(unsigned int length, double *srcMagnitude, double *srcPhase);
     double broadband(unsigned int length, double *srcMagnitude);
+    void magnitudeTransform();
 	
 private:
     void initialise( DFConfig Config );
@@ -78,6 +100,7 @@ private:
     unsigned int m_halfLength;
     unsigned int m_stepSize;
     double m_dbRise;
+    float m_riseRatio; // 10^(dbRise/10)
     bool m_whiten;
     double m_whitenRelaxCoeff;
     double m_whitenFloor;
@@ -86,6 +109,7 @@ private:
     double* m_phaseHistory;
     double* m_phaseHistoryOld;
     double* m_magPeaks;
+    float* m_powerHistory; // broadband squared magnitudes
 
     double* m_windowed; // Array for windowed analysis frame
     double* m_magnitude; // Magnitude of analysis frame ( frequency domain )
@@ -94,6 +118,9 @@ private:
 
     Window<double> *m_window;
     PhaseVocoder* m_phaseVoc;	// Phase Vocoder
+    FFTReal* m_fft; // magnitude only types skip the phase vocoder
+    double* m_real;
+    double* m_imag;
 };
 
 #endif 
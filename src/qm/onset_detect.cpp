@@ -14,6 +14,9 @@
 
 /* Edited @Matthew Walker 01/01/21 - process time domain
                                    - add bass freq bin magnitude difference to feature value
+                                   - take a shared magnitude spectrum
+                                   - native frame interface for detector_pipeline
+                                   - reset keeps the detection function
 */
 
 #include "qm/onset_detect.h"
@@ -32,21 +35,22 @@ float onset_detector::m_preferredStepSecs = 0.01161;
 class onset_detectorData
 {
 public:
-    onset_detectorData(const DFConfig &config) : dfConfig(config) {
+    onset_detectorData(const DFConfig &config) :
+        dfConfig(config), frame(config.frameLength) {
 	df = new detection_function(config);
     }
     ~onset_detectorData() {
 	delete df;
     }
     void reset() {
-	delete df;
-	df = new detection_function(dfConfig);
-	dfOutput.clear();
+	df->reset();
+	dfOutput.clear(); // keeps its capacity for the next input
         origin = Vamp::RealTime::zeroTime;
     }
 
     DFConfig dfConfig;
     detection_function *df;
+    vector<double> frame; // double copy of the input frame
     vector<double> dfOutput;
     Vamp::RealTime origin;
 };
@@ -275,6 +279,7 @@ void
 onset_detector::reset()
 {
     if (m_d) m_d->reset();
+    m_spec_diff.clear();
 }
 
 size_t
@@ -362,23 +367,15 @@ onset_detector::process(const float *const *inputBuffers,
 
     size_t len = m_d->dfConfig.frameLength;
 
-    double *samples_copy = new double[len];
-    // double *imags = new double[len];
-
     // // We only support a single input channel
 
     for (size_t i = 0; i < len; ++i) {
-        samples_copy[i] = inputBuffers[0][i];
+        m_d->frame[i] = inputBuffers[0][i];
     }
 
-    // double output = m_d->df->processFrequencyDomain(reals, imags);
-
-    double output = m_d->df->processTimeDomain(samples_copy);
+    double output = m_d->df->processTimeDomain(m_d->frame.data());
     m_spec_diff.push_back(extract_freq_component(m_d->df->getSpectrumMagnitude()));
 
-    delete[] samples_copy;
-    // delete[] imags;
-
     if (m_d->dfOutput.empty()) m_d->origin = timestamp;
 
     m_d->dfOutput.push_back(output);
@@ -393,6 +390,83 @@ onset_detector::process(const float *const *inputBuffers,
     return returnFeatures;
 }
 
+void
+onset_detector::process_frame(const float *frame, long position)
+{
+    if (!m_d) {
+	cerr << "ERROR: onset_detector::process_frame: "
+	     << "onset_detector has not been initialised"
+	     << endl;
+	return;
+    }
+
+    size_t len = m_d->dfConfig.frameLength;
+    for (size_t i = 0; i < len; ++i) {
+        m_d->frame[i] = frame[i];
+    }
+
+    add_output(m_d->df->processTimeDomain(m_d->frame.data()), position);
+}
+
+void
+onset_detector::process_spectrum(const double *magnitude, long position)
+{
+    if (!m_d) {
+	cerr << "ERROR: onset_detector::process_spectrum: "
+	     << "onset_detector has not been initialised"
+	     << endl;
+	return;
+    }
+
+    add_output(m_d->df->processMagnitude(magnitude), position);
+}
+
+void
+onset_detector::add_output(double output, long position)
+{
+    m_spec_diff.push_back(extract_freq_component(m_d->df->getSpectrumMagnitude()));
+
+    if (m_d->dfOutput.empty()) {
+        m_d->origin = Vamp::RealTime::frame2RealTime
+            (position, lrintf(m_inputSampleRate));
+    }
+    m_d->dfOutput.push_back(output);
+}
+
+void
+onset_detector::reserve_frames(size_t frames)
+{
+    if (!m_d) return;
+    m_d->dfOutput.reserve(frames);
+    m_spec_diff.reserve(frames);
+}
+
+bool
+onset_detector::uses_magnitude_only() const
+{
+    return m_d && m_d->df->magnitudeOnly();
+}
+
+void
+onset_detector::clear_frames()
+{
+    if (!m_d) return;
+    m_d->dfOutput.clear();
+    m_spec_diff.clear();
+}
+
+void
+onset_detector::append_frames(const onset_detector &chunk)
+{
+    if (!m_d || !chunk.m_d) return;
+    if (m_d->dfOutput.empty()) m_d->origin = chunk.m_d->origin;
+    m_d->dfOutput.insert(m_d->dfOutput.end(),
+                         chunk.m_d->dfOutput.begin(),
+                         chunk.m_d->dfOutput.end());
+    m_spec_diff.insert(m_spec_diff.end(),
+                       chunk.m_spec_diff.begin(), chunk.m_spec_diff.end());
+}
+
 onset_detector::FeatureSet
 onset_detector::getRemainingFeatures()
 {
@@ -489,6 +563,7 @@ onset_detector::getRemainingFeatures()
         returnFeatures[2].push_back(feature); // smoothed df is output 2
     }
 
+    delete [] ppSrc;
     return returnFeatures;
 }
 
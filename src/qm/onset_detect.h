@@ -13,6 +13,8 @@
 */
 
 /* Edited @Matthew Walker 01/01/21 - add m_spec_diff
+                                   - take a shared magnitude spectrum
+                                   - native frame interface for detector_pipeline
 */
 
 #ifndef _ONSET_DETECT_PLUGIN_H_
@@ -57,6 +59,19 @@ public:
     FeatureSet process(const float *const *inputBuffers,
                        Vamp::RealTime timestamp);
 
+    // Native interface used by the analyzer, position is the frame start
+    // in samples. process_spectrum takes a spectrum computed elsewhere, only
+    // when uses_magnitude_only()
+    void process_frame(const float *frame, long position);
+    void process_spectrum(const double *magnitude, long position);
+    bool uses_magnitude_only() const;
+    void reserve_frames(size_t frames);
+
+    // For analysing a track in chunks, clear drops the outputs so far but
+    // keeps the detection function state, append adds a later chunk's
+    void clear_frames();
+    void append_frames(const onset_detector &chunk);
+
     FeatureSet getRemainingFeatures();
 
 protected:
@@ -67,6 +82,7 @@ protected:
     std::string m_program;
     static float m_preferredStepSecs;
     std::vector<double> m_spec_diff;
+    void add_output(double output, long position);
 };
 
 
@@ -14,15 +14,22 @@
 */
 
 /* Edited @Matthew Walker 01/01/21 - m_div added and algorithm updated to scale with m_div to increase resolution
+   - acf in get_rcf computed with a zero padded FFT, scaled from the zero
+     lag so it doesn't depend on the inverse transform's scaling
+   - banded transitions in viterbi_decode and transition weights kept
+     between frames in calculateBeats
 */
 
 #include "qm/tempo_track.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
+#include "dsp/transforms/FFT.h"
 #include "maths/MathUtilities.h"
 
 #define   EPS 0.0000008 // just some arbitrary small number
@@ -31,6 +38,33 @@ tempo_track::tempo_track(float rate, size_t increment, int step_div) :
     m_rate(rate), m_increment(increment), m_div(step_div) { }
 tempo_track::~tempo_track() { }
 
+// FFT and buffers for the acf, kept per thread so the plan is made once
+// for every frame of every track analysed on that thread
+struct acf_plan
+{
+    int size;
+    std::unique_ptr<FFTReal> fft;
+    vector<double> padded;
+    vector<double> real;
+    vector<double> imag;
+    vector<double> corr;
+};
+
+static acf_plan &
+get_acf_plan(int size)
+{
+    thread_local acf_plan plan = { 0, nullptr, {}, {}, {}, {} };
+    if (plan.size != size) {
+        plan.size = size;
+        plan.fft.reset(new FFTReal(size));
+        plan.padded.assign(size, 0.);
+        plan.real.assign(size, 0.);
+        plan.imag.assign(size, 0.);
+        plan.corr.assign(size, 0.);
+    }
+    return plan;
+}
+
 void
 tempo_track::filter_df(d_vec_t &df)
 {
@@ -119,9 +153,10 @@ tempo_track::calculateBeatPeriod(const vector<double> &df,
     // the default value of inputtempo in the beat tracking plugin is 120
     // so if the user specifies a different inputtempo, the rayparam will be updated
     // accordingly.
-    // note: 60*44100/512 is a magic number
-    // this might (will?) break if a user specifies a different frame rate for the onset detection function
-    double rayparam = (60*44100/(512/m_div))/inputtempo; // 64 for step_div=4, 8 for 8
+    // note: 60*44100/512 was a magic number, it is the detection function
+    // frame rate in frames per minute so take it from the rate and increment.
+    // Integer division as before, so the full rate result is unchanged
+    double rayparam = (60*int(m_rate)/int(m_increment))/inputtempo; // 64 for step_div=4, 8 for 8
 
     // these debug statements can be removed.
 //    std::cerr << "inputtempo" << inputtempo << std::endl;
@@ -204,18 +239,33 @@ tempo_track::get_rcf(const d_vec_t &dfframe_in, const d_vec_t &wv, d_vec_t &rcf)
 
     d_vec_t acf(dfframe.size());
 
+    // the inverse transform of the power spectrum is the autocorrelation,
+    // zero padded to at least twice the frame so it doesn't wrap around
+    int len = dfframe.size();
+    acf_plan &plan = get_acf_plan(MathUtilities::nextPowerOfTwo(2 * len));
+    std::copy(dfframe.begin(), dfframe.end(), plan.padded.begin());
+    std::fill(plan.padded.begin() + len, plan.padded.end(), 0.);
 
-    for (unsigned int lag=0; lag<dfframe.size(); lag++)
+    plan.fft->forward(plan.padded.data(), plan.real.data(), plan.imag.data());
+    for (int k = 0; k <= plan.size / 2; k++)
     {
-        double sum = 0.;
-        double tmp = 0.;
+        plan.real[k] = plan.real[k] * plan.real[k] + plan.imag[k] * plan.imag[k];
+        plan.imag[k] = 0.;
+    }
+    plan.fft->inverse(plan.real.data(), plan.imag.data(), plan.corr.data());
 
-        for (unsigned int n=0; n<(dfframe.size()-lag); n++)
-        {
-            tmp = dfframe[n] * dfframe[n+lag];
-            sum += tmp;
-        }
-        acf[lag] = static_cast<double> (sum/ (dfframe.size()-lag));
+    // FFT implementations differ in whether the inverse is scaled by 1/n,
+    // so the lags are scaled to make the zero lag the frame's energy
+    double energy = 0.;
+    for (int n = 0; n < len; n++)
+    {
+        energy += dfframe[n] * dfframe[n];
+    }
+    double scale = plan.corr[0] > 0. ? energy / plan.corr[0] : 0.;
+
+    for (int lag = 0; lag < len; lag++)
+    {
+        acf[lag] = plan.corr[lag] * scale / (len - lag);
         // myfile << acf[lag] << std::endl;
     }
 
@@ -256,119 +306,117 @@ tempo_track::viterbi_decode(const d_mat_t &rcfmat, const d_vec_t &wv, d_vec_t &b
     // following Kevin Murphy's Viterbi decoding to get best path of
     // beat periods through rfcmat
 
-    // make transition matrix
-    d_mat_t tmat;
-    for (unsigned int i=0;i<wv.size();i++)
-    {
-        tmat.push_back ( d_vec_t() ); // adds a new column
-        for (unsigned int j=0; j<wv.size(); j++)
-        {
-            tmat[i].push_back(0.); // fill with zeros initially
-        }
-    }
+    // the transition matrix is formed of Gaussians on the diagonal -
+    // implies slow tempo change - and is zero outside beat periods 20 to
+    // Q-20, as we don't want really short beat periods, or really long
+    // ones. Only the band around the diagonal where the Gaussian doesn't
+    // underflow to zero is kept, so the results are the same as with the
+    // full matrix.
 
     // variance of Gaussians in transition matrix
-    // formed of Gaussians on diagonal - implies slow tempo change
     double sigma = 1.;
-    // don't want really short beat periods, or really long ones
-    for (unsigned int i=20;i <wv.size()-20; i++)
+    d_vec_t gaussian;
+    for (int d = 0; ; d++)
     {
-        for (unsigned int j=20; j<wv.size()-20; j++)
-        {
-            double mu = static_cast<double>(i);
-            tmat[i][j] = exp( (-1.*pow((j-mu),2.)) / (2.*pow(sigma,2.)) );
-        }
+        double weight = exp( (-1.*pow(static_cast<double>(d),2.)) / (2.*pow(sigma,2.)) );
+        if (weight == 0.) break;
+        gaussian.push_back(weight);
     }
+    int width = gaussian.size() - 1;
 
-    // parameters for Viterbi decoding... this part is taken from
-    // Murphy's matlab
-
-    d_mat_t delta;
-    i_mat_t psi;
-    for (unsigned int i=0;i <rcfmat.size(); i++)
+    // weights[width + i - j] is the transition from period i to period j
+    d_vec_t weights(2*width + 1);
+    for (int d = -width; d <= width; d++)
     {
-        delta.push_back( d_vec_t());
-        psi.push_back( i_vec_t());
-        for (unsigned int j=0; j<rcfmat[i].size(); j++)
-        {
-            delta[i].push_back(0.); // fill with zeros initially
-            psi[i].push_back(0); // fill with zeros initially
-        }
+        weights[width + d] = gaussian[abs(d)];
     }
 
+    // parameters for Viterbi decoding... this part is taken from
+    // Murphy's matlab
 
-    unsigned int T = delta.size();
+    unsigned int T = rcfmat.size();
 
     if (T < 2) return; // can't do anything at all meaningful
 
-    unsigned int Q = delta[0].size();
+    int Q = rcfmat[0].size();
+    int qmin = 20;
+    int qmax = wv.size() - 21;
+
+    // one row of Q states per frame, filled with zeros initially
+    d_vec_t delta(T*Q, 0.);
+    i_vec_t psi(T*Q, 0);
 
     // initialize first column of delta
-    for (unsigned int j=0; j<Q; j++)
+    for (int j=0; j<Q; j++)
     {
-        delta[0][j] = wv[j] * rcfmat[0][j];
-        psi[0][j] = 0;
+        delta[j] = wv[j] * rcfmat[0][j];
     }
 
     double deltasum = 0.;
-    for (unsigned int i=0; i<Q; i++)
+    for (int i=0; i<Q; i++)
     {
-        deltasum += delta[0][i];
+        deltasum += delta[i];
     }
-    for (unsigned int i=0; i<Q; i++)
+    for (int i=0; i<Q; i++)
     {
-        delta[0][i] /= (deltasum + EPS);
+        delta[i] /= (deltasum + EPS);
     }
 
+    d_vec_t tmp_vec(weights.size());
 
     for (unsigned int t=1; t<T; t++)
     {
-        d_vec_t tmp_vec(Q);
+        const double *prev = &delta[(t-1)*Q];
+        double *current = &delta[t*Q];
+        int *current_psi = &psi[t*Q];
 
-        for (unsigned int j=0; j<Q; j++)
+        // rows outside qmin to qmax have no transitions, their maximum is
+        // zero at index zero as left by the initialisation
+        for (int j=qmin; j<=qmax && j<Q; j++)
         {
-            for (unsigned int i=0; i<Q; i++)
+            int first = std::max(qmin, j - width);
+            int last = std::min(qmax, j + width);
+            const double *row = &weights[width + first - j];
+
+            for (int i=0; i<=last-first; i++)
             {
-                tmp_vec[i] = delta[t-1][i] * tmat[j][i];
+                tmp_vec[i] = prev[first+i] * row[i];
             }
 
-            delta[t][j] = get_max_val(tmp_vec);
+            int index;
+            current[j] = get_max(tmp_vec.data(), last - first + 1, index);
 
-            psi[t][j] = get_max_ind(tmp_vec);
+            // everything outside the band is zero so the first maximum in
+            // the band is the first in the row, unless it is zero too
+            current_psi[j] = current[j] > 0. ? first + index : 0;
 
-            delta[t][j] *= rcfmat[t][j];
+            current[j] *= rcfmat[t][j];
         }
 
         // normalise current delta column
         double deltasum = 0.;
-        for (unsigned int i=0; i<Q; i++)
+        for (int i=0; i<Q; i++)
         {
-            deltasum += delta[t][i];
+            deltasum += current[i];
         }
-        for (unsigned int i=0; i<Q; i++)
+        for (int i=0; i<Q; i++)
         {
-            delta[t][i] /= (deltasum + EPS);
+            current[i] /= (deltasum + EPS);
         }
     }
-
     i_vec_t bestpath(T);
-    d_vec_t tmp_vec(Q);
-    for (unsigned int i=0; i<Q; i++)
-    {
-        tmp_vec[i] = delta[T-1][i];
-    }
 
     // find starting point - best beat period for "last" frame
-    bestpath[T-1] = get_max_ind(tmp_vec);
+    get_max(&delta[(T-1)*Q], Q, bestpath[T-1]);
 
     // backtrace through index of maximum values in psi
     for (unsigned int t=T-2; t>0 ;t--)
     {
-        bestpath[t] = psi[t+1][bestpath[t+1]];
+        bestpath[t] = psi[(t+1)*Q + bestpath[t+1]];
     }
 
     // weird but necessary hack -- couldn't get above loop to terminate at t >= 0
-    bestpath[0] = psi[1][bestpath[1]];
+    bestpath[0] = psi[Q + bestpath[1]];
 
     unsigned int lastind = 0;
     for (unsigned int i=0; i<T; i++)
@@ -409,6 +457,41 @@ tempo_track::get_max_val(const d_vec_t &df)
     return maxval;
 }
 
+// The maximum and the index of its first occurrence, or zero at index
+// zero when nothing is above zero, as get_max_val and get_max_ind. The
+// maximum is found first in four lanes, so the compares don't wait on
+// each other, then the index is searched for.
+double
+tempo_track::get_max(const double *values, int count, int &index)
+{
+    double lanes[4] = { 0., 0., 0., 0. };
+    int i = 0;
+    for (; i+4 <= count; i+=4)
+    {
+        for (int k=0; k<4; k++)
+        {
+            lanes[k] = values[i+k] > lanes[k] ? values[i+k] : lanes[k];
+        }
+    }
+    double maxval = 0.;
+    for (int k=0; k<4; k++)
+    {
+        maxval = lanes[k] > maxval ? lanes[k] : maxval;
+    }
+    for (; i<count; i++)
+    {
+        maxval = values[i] > maxval ? values[i] : maxval;
+    }
+
+    index = 0;
+    if (maxval > 0.)
+    {
+        while (values[index] != maxval) index++;
+    }
+
+    return maxval;
+}
+
 int
 tempo_track::get_max_ind(const d_vec_t &df)
 {
@@ -469,34 +552,45 @@ tempo_track::calculateBeats(const vector<double> &df,
 //    std::cerr << "alpha" << alpha << std::endl;
 //    std::cerr << "tightness" << tightness << std::endl;
 
+    // transition range, the weights only depend on the beat period which
+    // changes once per beat period frame at most, so they're kept until
+    // it does
+    d_vec_t txwt;
+    d_vec_t scorecands;
+    double txwt_period = -1.;
+
     // main loop
     for (unsigned int i=0; i<localscore.size(); i++)
     {
         int prange_min = -2*beat_period[i];
         int prange_max = round(-0.5*beat_period[i]);
 
-        // transition range
-        d_vec_t txwt (prange_max - prange_min + 1);
-        d_vec_t scorecands (txwt.size());
-
-        for (unsigned int j=0;j<txwt.size();j++)
+        if (beat_period[i] != txwt_period)
         {
-            double mu = static_cast<double> (beat_period[i]);
-            txwt[j] = exp( -0.5*pow(tightness * log((round(2*mu)-j)/mu),2));
-
-            // IF IN THE ALLOWED RANGE, THEN LOOK AT CUMSCORE[I+PRANGE_MIN+J
-            // ELSE LEAVE AT DEFAULT VALUE FROM INITIALISATION:  D_VEC_T SCORECANDS (TXWT.SIZE());
-
-            int cscore_ind = i+prange_min+j;
-            if (cscore_ind >= 0)
+            txwt_period = beat_period[i];
+            txwt.resize(prange_max - prange_min + 1);
+            scorecands.resize(txwt.size());
+            for (unsigned int j=0;j<txwt.size();j++)
             {
-                scorecands[j] = txwt[j] * cumscore[cscore_ind];
+                double mu = static_cast<double> (beat_period[i]);
+                txwt[j] = exp( -0.5*pow(tightness * log((round(2*mu)-j)/mu),2));
             }
         }
 
+        // IF IN THE ALLOWED RANGE, THEN LOOK AT CUMSCORE[I+PRANGE_MIN+J
+        // ELSE LEAVE AT THE DEFAULT VALUE OF ZERO
+        int count = txwt.size();
+        int first = std::min(std::max(-(int(i)+prange_min), 0), count);
+        std::fill(scorecands.begin(), scorecands.begin() + first, 0.);
+        int offset = int(i) + prange_min;
+        for (int j=first; j<count; j++)
+        {
+            scorecands[j] = txwt[j] * cumscore[offset + j];
+        }
+
         // find max value and index of maximum value
-        double vv = get_max_val(scorecands);
-        int xx = get_max_ind(scorecands);
+        int xx;
+        double vv = get_max(scorecands.data(), count, xx);
 
         cumscore[i] = alpha*vv + (1.-alpha)*localscore[i];
         backlink[i] = i+prange_min+xx;
@@ -14,6 +14,8 @@
 */
 
 /* Edited @Matthew Walker 01/01/21 - add m_div
+   - add get_max
+   - tempo_track_test friend for test/tempo_track_test.cpp
 */
 
 #ifndef TEMPOTRACKV2_H
@@ -72,6 +74,8 @@ public:
                         double alpha, double tightness);
 
 private:
+    friend class tempo_track_test;
+
     typedef vector<int> i_vec_t;
     typedef vector<vector<int> > i_mat_t;
     typedef vector<double> d_vec_t;
@@ -88,6 +92,7 @@ private:
     void viterbi_decode(const d_mat_t &rcfmat, const d_vec_t &wv,
                         d_vec_t &bp, d_vec_t &tempi);
     double get_max_val(const d_vec_t &df);
+    double get_max(const double *values, int count, int &index);
     int get_max_ind(const d_vec_t &df);
     void normalise_vec(d_vec_t &df);
 };
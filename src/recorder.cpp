@@ -48,7 +48,7 @@ int recorder::create_output() {
     return 1;
   }
 
-  m_codec_ctx->sample_rate = 44100;
+  m_codec_ctx->sample_rate = engine_sample_rate;
   m_codec_ctx->channel_layout = 3;
   m_codec_ctx->channels = 2;
   m_codec_ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
@@ -3,15 +3,22 @@
 #include "ring_buffer.h"
 #define ring_buffer_def
 #endif
+#include <algorithm>
 #include <iostream>
 
-ring_buffer::ring_buffer(int size) : m_size(size) {
-  m_data = new float[size];
+static int next_power_of_two(int size) {
+  int power = 1;
+  while (power < size) {
+    power <<= 1;
+  }
+  return power;
+}
+
+ring_buffer::ring_buffer(int size)
+    : m_size(next_power_of_two(size)), m_rdptr(0), m_wrptr(0) {
+  m_data = new float[m_size];
   // memset( m_data, 0, size*4);
-  m_size = size;
-  m_rdptr = 0;
-  m_wrptr = 0;
-  m_space = size;
+  m_mask = m_size - 1;
 }
 
 ring_buffer::~ring_buffer() {
@@ -19,77 +26,108 @@ ring_buffer::~ring_buffer() {
   // std::cout << "ring buffer deleted" << std::endl;
 }
 
-// Set all data to 0 and flag buffer as empty.
+// Flag buffer as empty, only safe when neither side is in use.
 bool ring_buffer::empty() {
-  m_rdptr = 0;
-  m_wrptr = 0;
-  m_space = m_size;
+  m_rdptr.store(0, std::memory_order_relaxed);
+  m_wrptr.store(0, std::memory_order_release);
   return true;
 }
 
 int ring_buffer::read(float *data_ptr, int num_samples) {
-  // If there's nothing to read or no data available, then we can't read
-  // anything.
-  if (data_ptr == 0 || num_samples <= 0 || m_space == m_size) {
+  // If there's nothing to read or not enough data in buffer to fill read
+  // request dont read anything
+  if (data_ptr == 0 || num_samples <= 0) {
     return 0;
   }
 
-  int read_space = m_size - m_space;
-
-  // If there is not enough data in buffer to fill read request dont read
-  // anything
-  if (num_samples > read_space) {
+  ring_span first, second;
+  if (get_read_spans(first, second) < num_samples) {
     return 0;
   }
 
-  // Simultaneously keep track of how many bytes we've read and our position in
-  // the outgoing buffer
-  if (num_samples > m_size - m_rdptr) {
-    int len = m_size - m_rdptr;
-    memcpy(data_ptr, m_data + m_rdptr, len * 4);
-    memcpy(data_ptr + len, m_data, (num_samples - len) * 4);
+  if (num_samples > first.length) {
+    memcpy(data_ptr, first.data, first.length * sizeof(float));
+    memcpy(data_ptr + first.length, second.data,
+           (num_samples - first.length) * sizeof(float));
   } else {
-    memcpy(data_ptr, m_data + m_rdptr, num_samples * 4);
+    memcpy(data_ptr, first.data, num_samples * sizeof(float));
   }
 
-  m_rdptr = (m_rdptr + num_samples) % m_size;
-  m_space += num_samples;
-
+  commit_read(num_samples);
   return num_samples;
 }
 
 // Write to the ring buffer.  Do not overwrite data that has not yet
 // been read.
-int ring_buffer::write(float *data_ptr, int num_samples) {
-  // If there's nothing to write or no room available, we can't write anything.
-  if (data_ptr == 0 || num_samples <= 0 || m_space == 0) {
+int ring_buffer::write(const float *data_ptr, int num_samples) {
+  // If there's nothing to write or not enough space in buffer to do the
+  // write request dont write anything
+  if (data_ptr == 0 || num_samples <= 0) {
     return 0;
   }
 
-  // If there is not enough space in buffer to do the write request dont write
-  // anything
-  if (num_samples > m_space) {
+  ring_span first, second;
+  if (get_write_spans(first, second) < num_samples) {
     return 0;
   }
 
-  // Simultaneously keep track of how many bytes we've written and our position
-  // in the incoming buffer
-  if (num_samples > m_size - m_wrptr) {
-    int len = m_size - m_wrptr;
-    memcpy(m_data + m_wrptr, data_ptr, len * 4);
-    memcpy(m_data, data_ptr + len, (num_samples - len) * 4);
+  if (num_samples > first.length) {
+    memcpy(first.data, data_ptr, first.length * sizeof(float));
+    memcpy(second.data, data_ptr + first.length,
+           (num_samples - first.length) * sizeof(float));
   } else {
-    memcpy(m_data + m_wrptr, data_ptr, num_samples * 4);
+    memcpy(first.data, data_ptr, num_samples * sizeof(float));
   }
 
-  m_wrptr = (m_wrptr + num_samples) % m_size;
-  m_space -= num_samples;
-
+  commit_write(num_samples);
   return num_samples;
 }
 
+// Free space as up to two spans, returns the total length
+int ring_buffer::get_write_spans(ring_span &first, ring_span &second) {
+  unsigned int wrptr = m_wrptr.load(std::memory_order_relaxed);
+  unsigned int rdptr = m_rdptr.load(std::memory_order_acquire);
+  int space = m_size - int(wrptr - rdptr);
+  int offset = wrptr & m_mask;
+
+  first.data = m_data + offset;
+  first.length = std::min(space, m_size - offset);
+  second.data = m_data;
+  second.length = space - first.length;
+  return space;
+}
+
+// Publish samples written through the write spans
+void ring_buffer::commit_write(int num_samples) {
+  m_wrptr.store(m_wrptr.load(std::memory_order_relaxed) + num_samples,
+                std::memory_order_release);
+}
+
+// Readable data as up to two spans, returns the total length
+int ring_buffer::get_read_spans(ring_span &first, ring_span &second) {
+  unsigned int rdptr = m_rdptr.load(std::memory_order_relaxed);
+  unsigned int wrptr = m_wrptr.load(std::memory_order_acquire);
+  int read_space = int(wrptr - rdptr);
+  int offset = rdptr & m_mask;
+
+  first.data = m_data + offset;
+  first.length = std::min(read_space, m_size - offset);
+  second.data = m_data;
+  second.length = read_space - first.length;
+  return read_space;
+}
+
+// Release samples consumed through the read spans
+void ring_buffer::commit_read(int num_samples) {
+  m_rdptr.store(m_rdptr.load(std::memory_order_relaxed) + num_samples,
+                std::memory_order_release);
+}
+
 int ring_buffer::get_size() { return m_size; }
 
-int ring_buffer::get_space() { return m_space; }
+int ring_buffer::get_space() { return m_size - get_read_space(); }
 
-int ring_buffer::get_read_space() { return m_size - m_space; }
\ No newline at end of file
+int ring_buffer::get_read_space() {
+  return int(m_wrptr.load(std::memory_order_acquire) -
+             m_rdptr.load(std::memory_order_acquire));
+}
@@ -1,19 +1,36 @@
 #ifndef ring_def
 
+#include <atomic>
+
+// Contiguous region of a ring buffer, a wrapped region is returned as two
+struct ring_span {
+  float *data;
+  int length;
+};
+
+// Single producer, single consumer. The producer may only call write and
+// the write span functions, the consumer only read and the read span
+// functions. Size is rounded up to a power of two.
 class ring_buffer {
 private:
   float *m_data;
   int m_size;
-  int m_rdptr;
-  int m_wrptr;
-  int m_space;
+  unsigned int m_mask;
+  std::atomic<unsigned int> m_rdptr; // free running, wrapped with m_mask
+  std::atomic<unsigned int> m_wrptr;
 
 public:
   ring_buffer(int size);
   ~ring_buffer();
+  ring_buffer(const ring_buffer &) = delete;
+  ring_buffer &operator=(const ring_buffer &) = delete;
   bool empty();
   int read(float *data_ptr, int num_samples);
-  int write(float *data_ptr, int num_samples);
+  int write(const float *data_ptr, int num_samples);
+  int get_write_spans(ring_span &first, ring_span &second);
+  void commit_write(int num_samples);
+  int get_read_spans(ring_span &first, ring_span &second);
+  void commit_read(int num_samples);
   int get_size();
   int get_space();
   int get_read_space();
@@ -0,0 +1,34 @@
+#include "scratch_arena.h"
+
+#include <algorithm>
+
+constexpr size_t min_block_size = 1 << 16; // samples
+
+scratch_arena::scratch_arena() : m_block(0), m_used(0), m_capacity(0) {}
+
+// Blocks too small for the request are skipped rather than split, a new
+// block is only added past the last one
+float *scratch_arena::allocate(size_t count) {
+  while (m_block < m_blocks.size() &&
+         m_block_sizes[m_block] - m_used < count) {
+    m_block++;
+    m_used = 0;
+  }
+  if (m_block == m_blocks.size()) {
+    size_t size = std::max(count, min_block_size);
+    m_blocks.push_back(std::make_unique<float[]>(size));
+    m_block_sizes.push_back(size);
+    m_capacity += size;
+  }
+
+  float *buffer = m_blocks[m_block].get() + m_used;
+  m_used += count;
+  return buffer;
+}
+
+void scratch_arena::rewind() {
+  m_block = 0;
+  m_used = 0;
+}
+
+size_t scratch_arena::get_capacity() { return m_capacity; }
@@ -0,0 +1,29 @@
+#ifndef scratch_arena_def
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Scratch samples for analysing one track. Buffers are cut from large
+// blocks in turn and all handed back at once by rewind, the blocks are
+// kept so later tracks needing no more than the largest so far allocate
+// nothing.
+class scratch_arena {
+private:
+  std::vector<std::unique_ptr<float[]>> m_blocks;
+  std::vector<size_t> m_block_sizes;
+  size_t m_block; // block buffers are being cut from
+  size_t m_used;  // samples of it handed out
+  size_t m_capacity;
+
+public:
+  scratch_arena();
+  scratch_arena(const scratch_arena &) = delete;
+  scratch_arena &operator=(const scratch_arena &) = delete;
+  float *allocate(size_t count); // not cleared, valid until rewind
+  void rewind();
+  size_t get_capacity();
+};
+
+#define scratch_arena_def
+#endif
@@ -0,0 +1,32 @@
+#include "spectral_frontend.h"
+
+#include <algorithm>
+#include <cmath>
+
+spectral_transform::spectral_transform(int window_size)
+    : m_window_size(window_size), m_transforms(0),
+      m_window(HanningWindow, window_size), m_fft(window_size),
+      m_frame(window_size), m_real(window_size), m_imag(window_size),
+      m_magnitude(window_size / 2 + 1) {}
+
+long spectral_transform::get_transform_count() { return m_transforms; }
+
+const double *spectral_transform::process(const float *frame) {
+  for (int i = 0; i < m_window_size; i++) {
+    m_frame[i] = frame[i];
+  }
+  m_window.cut(m_frame.data());
+
+  // swap halves as the phase vocoder does, the magnitudes are only the
+  // same to the last bit with the same input order
+  int half = m_window_size / 2;
+  for (int i = 0; i < half; i++) {
+    std::swap(m_frame[i], m_frame[i + half]);
+  }
+  m_fft.forward(m_frame.data(), m_real.data(), m_imag.data());
+  for (int i = 0; i <= half; i++) {
+    m_magnitude[i] = sqrt(m_real[i] * m_real[i] + m_imag[i] * m_imag[i]);
+  }
+  m_transforms++;
+  return m_magnitude.data();
+}
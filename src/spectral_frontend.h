@@ -0,0 +1,103 @@
+#ifndef spectral_frontend_def
+
+#include <base/Window.h>
+#include <dsp/transforms/FFT.h>
+
+#include <tuple>
+#include <vector>
+
+// A subscriber provides
+//   bool uses_magnitude_only() const;
+//   void process_spectrum(const double *magnitude, long position);
+//   void process_frame(const float *frame, long position);
+// the last for when it needs the phase and does its own transform
+template <class T> struct spectrum_subscriber {
+  T *detector;
+  int step_size;
+  int frame_div; // takes every frame_div'th frame, set by the frontend
+};
+
+template <class T>
+spectrum_subscriber<T> make_subscriber(T &detector, int step_size) {
+  return spectrum_subscriber<T>{&detector, step_size, 1};
+}
+
+// Hann window, FFT shift and magnitude as in the detection function's own
+// phase vocoder, so the spectra are the same as when each detector
+// transforms the frame itself
+class spectral_transform {
+private:
+  int m_window_size;
+  long m_transforms;
+  Window<double> m_window;
+  FFTReal m_fft;
+  std::vector<double> m_frame;
+  std::vector<double> m_real;
+  std::vector<double> m_imag;
+  std::vector<double> m_magnitude;
+
+public:
+  spectral_transform(int window_size);
+  const double *process(const float *frame);
+  long get_transform_count();
+};
+
+// Windows and transforms each analysis frame once and hands the magnitude
+// spectrum to every subscribed detector. Subscribers are composed at
+// compile time like the stages of a detector_pipeline.
+template <class... Subscribers> class spectral_frontend {
+private:
+  int m_step_size;
+  long m_frame_count;
+  long m_delivered; // frames handed to subscribers as spectra
+  spectral_transform m_transform;
+  std::tuple<spectrum_subscriber<Subscribers>...> m_subscribers;
+
+  template <class T>
+  void deliver(spectrum_subscriber<T> &subscriber, const float *frame,
+               long position, const double *&magnitude) {
+    if (m_frame_count % subscriber.frame_div != 0) {
+      return;
+    }
+    if (!subscriber.detector->uses_magnitude_only()) {
+      subscriber.detector->process_frame(frame, position);
+      return;
+    }
+    if (!magnitude) {
+      magnitude = m_transform.process(frame);
+    }
+    subscriber.detector->process_spectrum(magnitude, position);
+    m_delivered++;
+  }
+
+public:
+  // subscriber steps must be multiples of step_size, frames are counted
+  // from the first window so the window size must be a multiple too
+  spectral_frontend(int window_size, int step_size,
+                    spectrum_subscriber<Subscribers>... subscribers)
+      : m_step_size(step_size), m_frame_count(0), m_delivered(0),
+        m_transform(window_size), m_subscribers(subscribers...) {
+    std::apply(
+        [step_size](auto &...subscriber) {
+          ((subscriber.frame_div = subscriber.step_size / step_size), ...);
+        },
+        m_subscribers);
+  }
+
+  long get_transform_count() { return m_transform.get_transform_count(); }
+
+  long get_delivered_count() { return m_delivered; }
+
+  void process_frame(const float *frame, long position) {
+    const double *magnitude = nullptr; // transformed on first use
+    std::apply(
+        [&](auto &...subscriber) {
+          (deliver(subscriber, frame, position, magnitude), ...);
+        },
+        m_subscribers);
+    m_frame_count++;
+  }
+};
+
+#define spectral_frontend_def
+#endif
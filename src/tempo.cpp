@@ -56,11 +56,22 @@ int tempo::fill_output_buffer() {
       std::cout << "failed to read from track" << std::endl;
       return read_samples;
     } else {
+      // resample straight into the ring buffer when the free space is
+      // contiguous, otherwise go through m_output_samples
+      ring_span first, second;
+      m_ring_buffer.get_write_spans(first, second);
+      bool in_place = first.length >= m_data.output_frames * 2;
+      m_data.data_out = in_place ? first.data : m_output_samples;
+
       if ((error = src_process(m_state, &m_data))) {
         std::cout << "ERROR " << src_strerror(error) << std::endl;
         return 1;
       }
-      m_ring_buffer.write(m_output_samples, m_data.output_frames_gen * 2);
+      if (in_place) {
+        m_ring_buffer.commit_write(m_data.output_frames_gen * 2);
+      } else {
+        m_ring_buffer.write(m_output_samples, m_data.output_frames_gen * 2);
+      }
     }
   }
   return 0;
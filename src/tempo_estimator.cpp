@@ -0,0 +1,180 @@
+#include "tempo_estimator.h"
+
+#include <maths/MathUtilities.h>
+
+#include <algorithm>
+#include <cmath>
+
+#define SEGMENT_SIZE 8192 // envelope frames per autocorrelation segment
+#define COMB_BEATS 8      // multiples of the period scored by the comb
+#define COARSE_STEP 0.05  // BPM between comb candidates
+#define FINE_STEP 0.01    // BPM between folds, also the output resolution
+#define FINE_RANGE 0.1    // BPM either side of the comb's best
+#define PRIOR_WIDTH 0.2   // octaves, standard deviation of the tempo prior
+
+// Candidates are the octave centred on the hint, so no candidate is double
+// or half another
+tempo_estimator::tempo_estimator(double frame_rate, double hint_bpm)
+    : m_frame_rate(frame_rate), m_hint_bpm(hint_bpm),
+      m_min_bpm(hint_bpm / sqrt(2)), m_max_bpm(hint_bpm * sqrt(2)),
+      m_segment_size(SEGMENT_SIZE), m_fft(SEGMENT_SIZE * 2),
+      m_padded(SEGMENT_SIZE * 2), m_real(SEGMENT_SIZE * 2),
+      m_imag(SEGMENT_SIZE * 2), m_corr(SEGMENT_SIZE * 2) {}
+
+// Autocorrelation up to max_lag summed over segments, each zero padded to
+// twice its length, divided by the number of products at each lag so long
+// lags aren't penalised. Only pairs within a segment are counted, which
+// keeps the transforms small for long inputs.
+void tempo_estimator::get_acf(const std::vector<double> &envelope,
+                              int max_lag) {
+  std::vector<double> pairs(max_lag + 1, 0);
+  m_acf.assign(max_lag + 1, 0);
+  int size = m_segment_size * 2;
+
+  for (size_t start = 0; start < envelope.size(); start += m_segment_size) {
+    int length = std::min(envelope.size() - start, size_t(m_segment_size));
+    std::fill(m_padded.begin(), m_padded.end(), 0);
+    std::copy(envelope.begin() + start, envelope.begin() + start + length,
+              m_padded.begin());
+
+    m_fft.forward(m_padded.data(), m_real.data(), m_imag.data());
+    for (int k = 0; k <= size / 2; k++) {
+      m_real[k] = m_real[k] * m_real[k] + m_imag[k] * m_imag[k];
+      m_imag[k] = 0;
+    }
+    m_fft.inverse(m_real.data(), m_imag.data(), m_corr.data());
+
+    for (int lag = 0; lag <= max_lag && lag < length; lag++) {
+      m_acf[lag] += m_corr[lag];
+      pairs[lag] += length - lag;
+    }
+  }
+
+  for (int lag = 0; lag <= max_lag; lag++) {
+    if (pairs[lag] > 0) {
+      m_acf[lag] /= pairs[lag];
+    }
+  }
+}
+
+// Sum of the autocorrelation at multiples of the period, interpolated as
+// the period is fractional
+double tempo_estimator::get_comb_score(double period) {
+  double score = 0;
+  for (int beat = 1; beat <= COMB_BEATS; beat++) {
+    double lag = beat * period;
+    int index = int(lag);
+    if (index + 1 >= int(m_acf.size())) {
+      break;
+    }
+    double fraction = lag - index;
+    score += m_acf[index] * (1 - fraction) + m_acf[index + 1] * fraction;
+  }
+  return score;
+}
+
+// Folds the whole envelope at the period, a frame per bin, and returns the
+// highest smoothed bin mean. The further the period is from the true one
+// the more the beats drift across bins over the track and the lower the
+// peak. phase is the peak's position in frames from the envelope start.
+double tempo_estimator::fold(const std::vector<double> &envelope,
+                             double period, double &phase) {
+  int bins = int(ceil(period));
+  m_fold.assign(bins, 0);
+  m_fold_count.assign(bins, 0);
+
+  double position = 0; // frame index modulo the period
+  for (size_t i = 0; i < envelope.size(); i++) {
+    int bin = int(position);
+    m_fold[bin] += envelope[i];
+    m_fold_count[bin]++;
+    position += 1;
+    if (position >= period) {
+      position -= period;
+    }
+  }
+
+  std::vector<double> mean(bins);
+  for (int bin = 0; bin < bins; bin++) {
+    mean[bin] = m_fold_count[bin] > 0 ? m_fold[bin] / m_fold_count[bin] : 0;
+  }
+
+  // bins wrap around, a beat near the start is also near the end
+  double best = -1;
+  int best_bin = 0;
+  std::vector<double> smooth(bins);
+  for (int bin = 0; bin < bins; bin++) {
+    smooth[bin] = 0.25 * mean[(bin + bins - 1) % bins] + 0.5 * mean[bin] +
+                  0.25 * mean[(bin + 1) % bins];
+    if (smooth[bin] > best) {
+      best = smooth[bin];
+      best_bin = bin;
+    }
+  }
+
+  // parabola through the peak and its neighbours, each bin holds frames
+  // from its start to the next so its centre is half a frame in
+  double left = smooth[(best_bin + bins - 1) % bins];
+  double right = smooth[(best_bin + 1) % bins];
+  double curvature = left - 2 * best + right;
+  double offset = curvature < 0 ? 0.5 * (left - right) / curvature : 0;
+  phase = fmod(best_bin + 0.5 + offset + period, period);
+  return best;
+}
+
+// Log normal weighting around the tempo hint, as the tempo tracker's
+// Rayleigh weighting, so a strong period at 4/3 or 5/4 of the beat in a
+// broken pattern doesn't win over the beat
+double tempo_estimator::get_prior(double bpm) {
+  double octaves = log2(bpm / m_hint_bpm);
+  return exp(-0.5 * octaves * octaves / (PRIOR_WIDTH * PRIOR_WIDTH));
+}
+
+// bpm to FINE_STEP, phase in envelope frames of the first beat
+int tempo_estimator::estimate(const std::vector<double> &envelope,
+                              double &bpm, double &phase) {
+  double max_period = 60 * m_frame_rate / m_min_bpm;
+  if (envelope.size() < max_period * COMB_BEATS * 2 || m_min_bpm <= 0 ||
+      m_max_bpm <= m_min_bpm) {
+    return 1;
+  }
+
+  // onsets above the local mean, as the tempo tracker sees them
+  std::vector<double> onsets(envelope);
+  MathUtilities::adaptiveThreshold(onsets);
+
+  int max_lag = std::min(int(max_period * COMB_BEATS) + 2, m_segment_size - 1);
+  get_acf(onsets, max_lag);
+
+  double best_score = 0;
+  double coarse_bpm = 0;
+  for (double candidate = m_min_bpm; candidate <= m_max_bpm;
+       candidate += COARSE_STEP) {
+    double score = get_comb_score(60 * m_frame_rate / candidate) *
+                   get_prior(candidate);
+    if (score > best_score) {
+      best_score = score;
+      coarse_bpm = candidate;
+    }
+  }
+  if (best_score <= 0) {
+    return 1;
+  }
+
+  double best_fold = -1;
+  double fine_bpm = coarse_bpm;
+  for (double offset = -FINE_RANGE; offset <= FINE_RANGE + FINE_STEP / 2;
+       offset += FINE_STEP) {
+    double candidate = round((coarse_bpm + offset) / FINE_STEP) * FINE_STEP;
+    double candidate_phase;
+    double peak = fold(onsets, 60 * m_frame_rate / candidate, candidate_phase);
+    if (peak > best_fold) {
+      best_fold = peak;
+      fine_bpm = candidate;
+    }
+  }
+
+  bpm = fine_bpm;
+  fold(onsets, 60 * m_frame_rate / bpm, phase);
+  return 0;
+}
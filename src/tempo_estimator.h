@@ -0,0 +1,39 @@
+#ifndef tempo_estimator_def
+
+#include <dsp/transforms/FFT.h>
+
+#include <vector>
+
+// Constant tempo estimate over a whole track from an onset envelope.
+// Periods are scored with a comb over the envelope's autocorrelation, the
+// best is refined by folding the whole envelope at ever finer tempo steps
+// and the phase is read once from the final fold.
+class tempo_estimator {
+private:
+  double m_frame_rate; // envelope frames per second
+  double m_hint_bpm;
+  double m_min_bpm;
+  double m_max_bpm;
+  int m_segment_size;
+  FFTReal m_fft;
+  std::vector<double> m_padded;
+  std::vector<double> m_real;
+  std::vector<double> m_imag;
+  std::vector<double> m_corr;
+  std::vector<double> m_acf;
+  std::vector<double> m_fold;
+  std::vector<int> m_fold_count;
+  void get_acf(const std::vector<double> &envelope, int max_lag);
+  double get_comb_score(double period);
+  double get_prior(double bpm);
+  double fold(const std::vector<double> &envelope, double period,
+              double &phase);
+
+public:
+  tempo_estimator(double frame_rate, double hint_bpm);
+  int estimate(const std::vector<double> &envelope, double &bpm,
+               double &phase);
+};
+
+#define tempo_estimator_def
+#endif
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc_counter.h"
 #include "filter.h"
 #include "track.h"
 
@@ -16,47 +17,284 @@ extern "C" {
 #include "libavutil/audio_fifo.h"
 }
 
+#include <sys/mman.h>
+
 #define BUF_SIZE 20480
+#define DECODE_AHEAD_BUF_SIZE (BUF_SIZE * 16)
+#define DEFAULT_FRAME_SIZE 4096 // for codecs that don't set a frame size
+#define WARM_UP_REFILLS 8
+#define AVIO_BUF_SIZE 65536
+#define CACHE_LENGTH_TOLERANCE 0.1 // seconds, encoder delay and padding
+#define CACHE_LENGTH_TOLERANCE_SHARE 0.005 // of the duration, for estimates
+
+input_mode_t track::s_input_mode = INPUT_BUFFERED;
 
 #undef av_err2str
 #define av_err2str(errnum)                                                     \
   av_make_error_string((char *)__builtin_alloca(AV_ERROR_MAX_STRING_SIZE),     \
                        AV_ERROR_MAX_STRING_SIZE, errnum)
 
-track::track(std::string path) : m_ring_buffer(BUF_SIZE) {
+track::track(std::string path, bool decode_ahead)
+    : m_ring_buffer(decode_ahead ? DECODE_AHEAD_BUF_SIZE : BUF_SIZE) {
   m_path = path; // seems this is needed
   m_format_ctx = nullptr;
   m_codec_ctx = nullptr;
   m_codec = nullptr;
   m_audio_stream_index = 0;
+  m_input_pos = 0;
+  m_avio_ctx = nullptr;
+  m_cache_samples = nullptr;
+  m_cache_size = 0;
+  m_cache_pos = 0;
+  m_dec_frame = nullptr;
+  m_dec_pkt = nullptr;
+  m_swr_ctx = nullptr;
+  m_resample_buffer = nullptr;
+  m_resample_capacity = 0;
+  m_frame_data_length = 0;
+  m_frame_length = 0;
+  m_frame_offset = -1;
+  m_direct_ptr = nullptr;
+  m_direct_remaining = 0;
+  m_refill_count = 0;
+  m_steady_state_allocations = 0;
+  m_decode_ahead = decode_ahead;
+  m_decode_done = false;
+  m_decode_stop = false;
+  m_draining = false;
+}
+
+track::~track() {
+  if (m_decode_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_ring_mutex);
+      m_decode_stop = true;
+    }
+    m_ring_cv.notify_all();
+    m_decode_thread.join();
+  }
+  if (m_dec_frame) {
+    av_frame_free(&m_dec_frame);
+  }
+  if (m_dec_pkt) {
+    av_packet_free(&m_dec_pkt);
+  }
+  if (m_swr_ctx) {
+    swr_free(&m_swr_ctx);
+  }
+  delete[] m_resample_buffer;
+  if (m_codec_ctx) {
+    avcodec_free_context(&m_codec_ctx);
+  }
+  if (m_format_ctx) {
+    avformat_close_input(&m_format_ctx);
+  }
+  if (m_avio_ctx) {
+    av_freep(&m_avio_ctx->buffer);
+    avio_context_free(&m_avio_ctx);
+  }
 }
 
-void track::planar_to_interleaved(float **input_samples, float *output_samples,
-                                  int length) {
-  for (int i = 0; i < length; i++) {
-    output_samples[i] = input_samples[i % 2][i / 2];
+void track::set_input_mode(input_mode_t mode) { s_input_mode = mode; }
+
+int track::read_mapped(void *opaque, uint8_t *buf, int buf_size) {
+  track *source = static_cast<track *>(opaque);
+  int64_t remaining = int64_t(source->m_input_map.size()) - source->m_input_pos;
+  if (remaining <= 0) {
+    return AVERROR_EOF;
+  }
+  int length = std::min(int64_t(buf_size), remaining);
+  memcpy(buf, source->m_input_map.data() + source->m_input_pos, length);
+  source->m_input_pos += length;
+  return length;
+}
+
+int64_t track::seek_mapped(void *opaque, int64_t offset, int whence) {
+  track *source = static_cast<track *>(opaque);
+  int64_t size = source->m_input_map.size();
+
+  whence &= ~AVSEEK_FORCE;
+  if (whence == AVSEEK_SIZE) {
+    return size;
+  } else if (whence == SEEK_CUR) {
+    offset += source->m_input_pos;
+  } else if (whence == SEEK_END) {
+    offset += size;
+  } else if (whence != SEEK_SET) {
+    return -1;
+  }
+
+  if (offset < 0 || offset > size) {
+    return -1;
+  }
+  source->m_input_pos = offset;
+  return offset;
+}
+
+// Map the input file and have avformat read it through callbacks rather
+// than read() calls, the page cache does the readahead
+int track::open_mapped_input() {
+  if (m_input_map.open(m_path) != 0) {
+    return 1;
+  }
+  m_input_map.advise(MADV_SEQUENTIAL);
+  if (s_input_mode == INPUT_MMAP_WILLNEED) {
+    m_input_map.advise(MADV_WILLNEED);
+  }
+
+  unsigned char *avio_buffer = (unsigned char *)av_malloc(AVIO_BUF_SIZE);
+  if (!avio_buffer) {
+    return 1;
+  }
+  m_avio_ctx = avio_alloc_context(avio_buffer, AVIO_BUF_SIZE, 0, this,
+                                  &track::read_mapped, nullptr,
+                                  &track::seek_mapped);
+  m_format_ctx = avformat_alloc_context();
+  if (!m_avio_ctx || !m_format_ctx) {
+    std::cout << "Error allocating mapped input context" << std::endl;
+    return 1;
+  }
+  m_format_ctx->pb = m_avio_ctx;
+  return 0;
+}
+
+// offset is the position of output_samples[0] in the interleaved frame
+void track::planar_to_interleaved(float **input_samples, int offset,
+                                  float *output_samples, int length) {
+  const float *left = input_samples[0];
+  const float *right = input_samples[1];
+  int end = offset + length;
+  int i = offset;
+
+  if (i % 2 == 1 && i < end) {
+    *output_samples++ = right[i / 2];
+    i++;
+  }
+  for (; i + 1 < end; i += 2) {
+    output_samples[0] = left[i / 2];
+    output_samples[1] = right[i / 2];
+    output_samples += 2;
+  }
+  if (i < end) {
+    *output_samples = left[i / 2];
+  }
+}
+
+// Resampled frames are already interleaved
+void track::copy_samples(float **input_samples, int offset,
+                         float *output_samples, int length) {
+  if (m_swr_ctx) {
+    if (length > 0) {
+      memcpy(output_samples, input_samples[0] + offset,
+             length * sizeof(float));
+    }
+  } else {
+    planar_to_interleaved(input_samples, offset, output_samples, length);
   }
 }
 
-int track::read(float *data_ptr, int num_samples) {
-  if (m_ring_buffer.read(data_ptr, num_samples) > 0) {
+// Wake the other side of the decode ahead buffer, taking the lock so a
+// notification can't fall between its check and its wait
+void track::wake() {
+  { std::lock_guard<std::mutex> lock(m_ring_mutex); }
+  m_ring_cv.notify_all();
+}
+
+// Returns num_samples, or 0 at the end of the track. With allow_short the
+// last read returns what was left instead.
+int track::read(float *data_ptr, int num_samples, bool allow_short) {
+  if (m_pcm_reader.is_open()) {
+    int read_samples = m_pcm_reader.read(data_ptr, num_samples);
+    if (read_samples != num_samples) {
+      std::cout << "end of PCM track " << m_path << std::endl;
+      return allow_short ? read_samples : 0;
+    }
     return num_samples;
-  } else if (fill_output_buffer() > 0) {
-    std::cout << m_path << " failed to fill output buffer" << std::endl;
-    return 0;
   }
-  if (m_ring_buffer.read(data_ptr, num_samples) > 0) {
+
+  if (m_cache_samples) {
+    if (m_cache_pos + num_samples > m_cache_size) {
+      std::cout << "end of cached track " << m_path << std::endl;
+      if (!allow_short) {
+        return 0;
+      }
+      num_samples = m_cache_size - m_cache_pos;
+    }
+    memcpy(data_ptr, m_cache_samples + m_cache_pos,
+           num_samples * sizeof(float));
+    m_cache_pos += num_samples;
     return num_samples;
-  } else {
-    std::cout << "failed to read from track output buffer " << m_path
-              << std::endl;
-    return 0;
   }
+
+  if (m_decode_thread.joinable()) {
+    if (m_ring_buffer.get_read_space() < num_samples) {
+      std::unique_lock<std::mutex> lock(m_ring_mutex);
+      m_ring_cv.wait(lock, [this, num_samples] {
+        return m_ring_buffer.get_read_space() >= num_samples || m_decode_done;
+      });
+    }
+    int read_samples = m_ring_buffer.read(data_ptr, num_samples);
+    if (read_samples != num_samples && allow_short) {
+      read_samples =
+          m_ring_buffer.read(data_ptr, m_ring_buffer.get_read_space());
+    }
+    wake();
+    if (read_samples != num_samples) {
+      std::cout << "end of decoded track " << m_path << std::endl;
+      return allow_short ? read_samples : 0;
+    }
+    return num_samples;
+  }
+
+  int buffered = m_ring_buffer.get_read_space();
+  if (buffered >= num_samples) {
+    return m_ring_buffer.read(data_ptr, num_samples);
+  }
+
+  // take what is buffered then decode straight into the caller's buffer,
+  // only the tail of the last frame goes through the ring buffer
+  m_ring_buffer.read(data_ptr, buffered);
+  m_direct_ptr = data_ptr + buffered;
+  m_direct_remaining = num_samples - buffered;
+  int error = fill_output_buffer();
+  m_direct_ptr = nullptr;
+
+  if (error != 0 || m_direct_remaining > 0) {
+    std::cout << m_path << " failed to fill output buffer" << std::endl;
+    return allow_short ? num_samples - m_direct_remaining : 0;
+  }
+  return num_samples;
 }
 
 int track::open_audio_source() {
   int error;
 
+  if (pcm_cache::open(m_path, m_cache_map, m_cache_samples, m_cache_size) ==
+      0) {
+    std::cout << m_path << ": Using cached PCM, "
+              << std::to_string(m_cache_size) << " samples" << std::endl;
+    return 0;
+  }
+
+  // uncompressed files are converted straight from a mapping, no decoding
+  if (pcm_reader::is_pcm_file(m_path) && m_pcm_reader.open(m_path) == 0) {
+    if (m_pcm_reader.get_sample_rate() == engine_sample_rate) {
+      return 0;
+    }
+    std::cout << m_path << ": PCM sample rate needs converting, using FFmpeg"
+              << std::endl;
+    m_pcm_reader.close();
+  }
+
+  if (s_input_mode != INPUT_BUFFERED && open_mapped_input() != 0) {
+    std::cout << "Error mapping " << m_path << ", using buffered reads"
+              << std::endl;
+    if (m_format_ctx) {
+      avformat_free_context(m_format_ctx);
+      m_format_ctx = nullptr;
+    }
+  }
+
   error = avformat_open_input(&m_format_ctx, m_path.c_str(), nullptr, nullptr);
 
   if (error < 0) {
@@ -102,9 +340,16 @@ int track::open_audio_source() {
     return 1;
   }
 
-  if (m_codec_ctx->sample_fmt != AV_SAMPLE_FMT_FLTP) {
-    std::cout << "Error formas is not AV_SAMPLE_FMT_FLTP" << std::endl;
-    return 1; // only support this for now
+  if (m_decode_ahead) {
+    // let FFmpeg use its own threads where the codec has them
+    m_codec_ctx->thread_count = 0;
+    m_codec_ctx->thread_type = 0;
+    if (m_codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) {
+      m_codec_ctx->thread_type |= FF_THREAD_FRAME;
+    }
+    if (m_codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) {
+      m_codec_ctx->thread_type |= FF_THREAD_SLICE;
+    }
   }
 
   if (avcodec_open2(m_codec_ctx, m_codec, NULL) < 0) {
@@ -121,45 +366,330 @@ int track::open_audio_source() {
   std::cout << "	m_codec_ctx bit_rate: "
             << std::to_string(m_codec_ctx->bit_rate) << std::endl;
 
+  // FLTP stereo at the engine rate is interleaved straight from the frame,
+  // anything else goes through swresample once as it is decoded
+  if (m_codec_ctx->sample_fmt != AV_SAMPLE_FMT_FLTP ||
+      m_codec_ctx->sample_rate != engine_sample_rate ||
+      m_codec_ctx->channels != engine_channels) {
+    if (open_resampler() != 0) {
+      return 1;
+    }
+  }
+
+  m_dec_frame = av_frame_alloc();
+  m_dec_pkt = av_packet_alloc();
+  if (!m_dec_frame || !m_dec_pkt) {
+    std::cout << "Error allocating decode frame" << std::endl;
+    return 1;
+  }
+  int frame_size = m_codec_ctx->frame_size > 0 ? m_codec_ctx->frame_size
+                                               : DEFAULT_FRAME_SIZE;
+  if (m_swr_ctx) {
+    frame_size = swr_get_out_samples(m_swr_ctx, frame_size);
+  }
+  m_frame_data_length = frame_size * engine_channels;
+  m_cache_writer.begin(m_path);
+
+  if (m_decode_ahead) {
+    std::cout << "	decoding ahead, codec thread type: "
+              << std::to_string(m_codec_ctx->active_thread_type) << std::endl;
+    m_decode_thread = std::thread(&track::decode_loop, this);
+  }
+
+  return 0;
+}
+
+int track::open_resampler() {
+  int64_t channel_layout = m_codec_ctx->channel_layout;
+  if (channel_layout == 0) {
+    channel_layout = av_get_default_channel_layout(m_codec_ctx->channels);
+  }
+
+  m_swr_ctx = swr_alloc_set_opts(nullptr, AV_CH_LAYOUT_STEREO,
+                                 AV_SAMPLE_FMT_FLT, engine_sample_rate,
+                                 channel_layout, m_codec_ctx->sample_fmt,
+                                 m_codec_ctx->sample_rate, 0, nullptr);
+  if (!m_swr_ctx || swr_init(m_swr_ctx) < 0) {
+    std::cout << "Error initialising resampler for " << m_path << std::endl;
+    return 1;
+  }
+
+  std::cout << "	resampling "
+            << av_get_sample_fmt_name(m_codec_ctx->sample_fmt) << " "
+            << std::to_string(m_codec_ctx->sample_rate) << " Hz to flt "
+            << std::to_string(engine_sample_rate) << " Hz" << std::endl;
   return 0;
 }
 
+// Converts m_dec_frame, straight into the caller's buffer or the ring
+// buffer when the whole output fits, otherwise into m_resample_buffer to
+// be delivered from. Returns the samples left to deliver, -1 on error.
+int track::resample_frame() {
+  int max_frames = swr_get_out_samples(m_swr_ctx, m_dec_frame->nb_samples);
+  int max_samples = max_frames * engine_channels;
+  const uint8_t **input = (const uint8_t **)m_dec_frame->extended_data;
+  float *output = nullptr;
+  int converted;
+
+  ring_span first, second;
+  m_ring_buffer.get_write_spans(first, second);
+  if (m_direct_ptr && m_direct_remaining >= max_samples) {
+    output = m_direct_ptr;
+  } else if ((!m_direct_ptr || m_direct_remaining == 0) &&
+             first.length >= max_samples) {
+    output = first.data;
+  }
+
+  if (output) {
+    converted = swr_convert(m_swr_ctx, (uint8_t **)&output, max_frames, input,
+                            m_dec_frame->nb_samples);
+    if (converted < 0) {
+      return -1;
+    }
+    converted *= engine_channels;
+    m_cache_writer.write(output, converted);
+    if (output == m_direct_ptr) {
+      m_direct_ptr += converted;
+      m_direct_remaining -= converted;
+    } else {
+      m_ring_buffer.commit_write(converted);
+      if (m_decode_ahead) {
+        wake();
+      }
+    }
+    return 0;
+  }
+
+  if (m_resample_capacity < max_samples) {
+    delete[] m_resample_buffer;
+    m_resample_buffer = new float[max_samples];
+    m_resample_capacity = max_samples;
+  }
+  converted = swr_convert(m_swr_ctx, (uint8_t **)&m_resample_buffer,
+                          max_frames, input, m_dec_frame->nb_samples);
+  return converted < 0 ? -1 : converted * engine_channels;
+}
+
+// Decodes until the caller's buffer is full, or in decode ahead mode until
+// the ring buffer is full
 int track::fill_output_buffer() {
-  int error;
-  AVFrame *dec_frame = av_frame_alloc();
-  AVPacket dec_pkt;
-  av_init_packet(&dec_pkt);
+  uint64_t allocations = get_thread_allocations();
+  int error = 0;
 
-  int frame_data_length = m_codec_ctx->frame_size * 2;
-  float *dec_samples = new float[frame_data_length];
+  while ((m_direct_ptr && m_direct_remaining > 0) ||
+         (!m_direct_ptr && m_ring_buffer.get_space() > m_frame_data_length)) {
+    if (decode_packet() != 0) {
+      error = 1;
+      break;
+    }
+  }
 
-  while (m_ring_buffer.get_space() > frame_data_length) {
-    error = av_read_frame(m_format_ctx, &dec_pkt);
-    if (error < 0) {
-      std::cout << "error reading frame from track " << m_path << std::endl;
-      return 1;
+  if (++m_refill_count > WARM_UP_REFILLS) {
+    m_steady_state_allocations += get_thread_allocations() - allocations;
+  }
+  return error;
+}
+
+// Producer side of decode ahead mode, the ring buffer is the bounded queue
+void track::decode_loop() {
+  while (!m_decode_stop && fill_output_buffer() == 0) {
+    if (m_ring_buffer.get_space() <= m_frame_data_length) {
+      std::unique_lock<std::mutex> lock(m_ring_mutex);
+      m_ring_cv.wait(lock, [this] {
+        return m_ring_buffer.get_space() > m_frame_data_length ||
+               m_decode_stop;
+      });
     }
-    if (dec_pkt.stream_index == m_audio_stream_index) {
-      error = avcodec_send_packet(m_codec_ctx, &dec_pkt);
-      if (error == AVERROR(EAGAIN)) {
-        std::cout << "Decoder can not take packets rn" << std::endl;
-      } else if (error < 0) {
-        std::cout << "Failed to send the dec_pkt to the decoder" << std::endl;
-        return 1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_ring_mutex);
+    m_decode_done = true;
+  }
+  m_ring_cv.notify_all();
+}
+
+// Interleaves part of a decoded frame into the caller's buffer while it
+// wants samples, then into the ring buffer. Returns the samples taken.
+int track::deliver(float **planes, int offset, int length) {
+  int delivered = 0;
+
+  if (m_direct_ptr && m_direct_remaining > 0) {
+    int direct_length = std::min(length, m_direct_remaining);
+    copy_samples(planes, offset, m_direct_ptr, direct_length);
+    m_cache_writer.write(m_direct_ptr, direct_length);
+    m_direct_ptr += direct_length;
+    m_direct_remaining -= direct_length;
+    delivered += direct_length;
+  }
+
+  ring_span spans[2];
+  m_ring_buffer.get_write_spans(spans[0], spans[1]);
+  for (auto &span : spans) {
+    int span_length = std::min(span.length, length - delivered);
+    copy_samples(planes, offset + delivered, span.data, span_length);
+    m_cache_writer.write(span.data, span_length);
+    m_ring_buffer.commit_write(span_length);
+    delivered += span_length;
+  }
+
+  if (m_decode_ahead) {
+    wake();
+  }
+  return delivered;
+}
+
+// Moves decoded frames out of the decoder, 1 if a frame is left pending
+// because there is nowhere to put it yet
+int track::drain_decoder() {
+  while (true) {
+    if (m_frame_offset < 0) {
+      if (avcodec_receive_frame(m_codec_ctx, m_dec_frame) < 0) {
+        return 0;
       }
-      while (avcodec_receive_frame(m_codec_ctx, dec_frame) >= 0) {
-        auto samples = (float **)(dec_frame->data);
-        planar_to_interleaved(samples, dec_samples, frame_data_length);
-        if (m_ring_buffer.write(dec_samples, frame_data_length) !=
-            frame_data_length) {
-          std::cout << "track output buffer overflow" << std::endl;
-          return 1;
+      m_frame_offset = 0;
+      m_frame_length = m_dec_frame->nb_samples * engine_channels;
+      if (m_swr_ctx) {
+        m_frame_length = resample_frame();
+        if (m_frame_length < 0) {
+          std::cout << "Error resampling frame from " << m_path << std::endl;
+          m_frame_length = 0;
         }
       }
     }
+    float **planes =
+        m_swr_ctx ? &m_resample_buffer : (float **)(m_dec_frame->data);
+    m_frame_offset +=
+        deliver(planes, m_frame_offset, m_frame_length - m_frame_offset);
+    if (m_frame_offset < m_frame_length) {
+      return 1;
+    }
+    av_frame_unref(m_dec_frame);
+    m_frame_offset = -1;
+  }
+}
+
+// Moves out what swresample still holds once the decoder is drained, 1 if
+// some is left pending because there is nowhere to put it yet
+int track::flush_resampler() {
+  while (true) {
+    if (m_frame_offset < 0) {
+      int max_frames =
+          std::max(swr_get_out_samples(m_swr_ctx, 0), DEFAULT_FRAME_SIZE);
+      int max_samples = max_frames * engine_channels;
+      if (m_resample_capacity < max_samples) {
+        delete[] m_resample_buffer;
+        m_resample_buffer = new float[max_samples];
+        m_resample_capacity = max_samples;
+      }
+      int converted = swr_convert(m_swr_ctx, (uint8_t **)&m_resample_buffer,
+                                  max_frames, nullptr, 0);
+      if (converted <= 0) {
+        return 0;
+      }
+      m_frame_offset = 0;
+      m_frame_length = converted * engine_channels;
+    }
+    m_frame_offset += deliver(&m_resample_buffer, m_frame_offset,
+                              m_frame_length - m_frame_offset);
+    if (m_frame_offset < m_frame_length) {
+      return 1;
+    }
+    m_frame_offset = -1;
+  }
+}
+
+// Keeps the cache entry only when its length agrees with the stream's
+// duration, a short decode would otherwise be served from the cache on
+// every later run. Streams that don't give a duration can't be checked.
+void track::finish_cache() {
+  if (!m_cache_writer.active()) {
+    return;
+  }
+  AVStream *stream = m_format_ctx->streams[m_audio_stream_index];
+  double duration = get_duration();
+  if (stream->duration > 0 && stream->time_base.den > 0) {
+    duration = double(stream->duration) * stream->time_base.num /
+               stream->time_base.den;
   }
-  delete[] dec_samples;
+  double decoded = double(m_cache_writer.get_num_samples()) / engine_channels /
+                   engine_sample_rate;
+  double tolerance =
+      std::max(CACHE_LENGTH_TOLERANCE, duration * CACHE_LENGTH_TOLERANCE_SHARE);
+  if (duration > 0 && std::abs(decoded - duration) > tolerance) {
+    std::cout << m_path << ": decoded " << std::to_string(decoded)
+              << " s of a " << std::to_string(duration)
+              << " s stream, not caching it" << std::endl;
+    m_cache_writer.abort();
+    return;
+  }
+  m_cache_writer.commit();
+}
+
+// Reads and decodes one packet, returns 1 once the stream has been read and
+// the decoder drained, or on error
+int track::decode_packet() {
+  int error;
+
+  if (drain_decoder() != 0) {
+    return 0; // output full, try again once there is space
+  }
+
+  if (m_draining) {
+    if (m_swr_ctx && flush_resampler() != 0) {
+      return 0;
+    }
+    finish_cache(); // whole track decoded and drained
+    return 1;
+  }
+
+  error = av_read_frame(m_format_ctx, m_dec_pkt);
+  if (error == AVERROR_EOF) {
+    // frame threaded decoders hold several frames back until they are sent
+    // an empty packet, those are drained by the next calls
+    avcodec_send_packet(m_codec_ctx, nullptr);
+    m_draining = true;
+    return 0;
+  }
+  if (error < 0) {
+    m_cache_writer.abort();
+    std::cout << "error reading frame from track " << m_path << std::endl;
+    return 1;
+  }
+  if (m_dec_pkt->stream_index == m_audio_stream_index) {
+    error = avcodec_send_packet(m_codec_ctx, m_dec_pkt);
+    if (error == AVERROR(EAGAIN)) {
+      std::cout << "Decoder can not take packets rn" << std::endl;
+    } else if (error < 0) {
+      std::cout << "Failed to send the dec_pkt to the decoder" << std::endl;
+      av_packet_unref(m_dec_pkt);
+      return 1;
+    }
+  }
+  av_packet_unref(m_dec_pkt);
+
+  drain_decoder();
   return 0;
 }
 
 std::string track::get_path() { return m_path; }
+
+bool track::is_cached() { return m_cache_samples != nullptr; }
+
+// Length in seconds, 0 if the container doesn't say
+double track::get_duration() {
+  if (m_cache_samples) {
+    return double(m_cache_size) / engine_channels / engine_sample_rate;
+  }
+  if (m_pcm_reader.is_open()) {
+    return double(m_pcm_reader.get_num_samples()) / engine_channels /
+           engine_sample_rate;
+  }
+  if (m_format_ctx && m_format_ctx->duration > 0) {
+    return double(m_format_ctx->duration) / AV_TIME_BASE;
+  }
+  return 0;
+}
+
+uint64_t track::get_steady_state_allocations() {
+  return m_steady_state_allocations;
+}
@@ -1,29 +1,92 @@
 #ifndef track_def
 
+#include <atomic>
+#include <condition_variable>
+#include <engine.h>
 #include <fstream>
+#include <mapped_file.h>
+#include <mutex>
+#include <pcm_cache.h>
+#include <pcm_reader.h>
 #include <ring_buffer.h>
+#include <thread>
 #include <vamp-plugin-sdk/vamp-sdk/Plugin.h>
 extern "C" {
 #include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
 }
 
+typedef enum {
+  INPUT_BUFFERED,      // plain reads by avformat
+  INPUT_MMAP,          // mapped with MADV_SEQUENTIAL
+  INPUT_MMAP_WILLNEED, // as above plus MADV_WILLNEED
+} input_mode_t;
+
 class track {
 private:
+  static input_mode_t s_input_mode;
   std::string m_path;
   ring_buffer m_ring_buffer;
   AVFormatContext *m_format_ctx;
   AVCodecContext *m_codec_ctx;
   AVCodec *m_codec;
   int m_audio_stream_index;
+  mapped_file m_input_map;
+  int64_t m_input_pos;
+  AVIOContext *m_avio_ctx;
+  pcm_reader m_pcm_reader;
+  mapped_file m_cache_map;
+  const float *m_cache_samples;
+  size_t m_cache_size;
+  size_t m_cache_pos;
+  pcm_cache_writer m_cache_writer;
+  AVFrame *m_dec_frame;
+  AVPacket *m_dec_pkt;
+  SwrContext *m_swr_ctx; // only set when the source is not already FLTP 44.1k
+  float *m_resample_buffer;
+  int m_resample_capacity;
+  int m_frame_data_length;
+  int m_frame_length;
+  int m_frame_offset; // samples of current frame already delivered, -1 if none
+  bool m_draining;    // end of stream reached, the decoder has been flushed
+  float *m_direct_ptr;
+  int m_direct_remaining;
+  int m_refill_count;
+  uint64_t m_steady_state_allocations;
+  bool m_decode_ahead;
+  bool m_decode_done;
+  std::atomic<bool> m_decode_stop;
+  std::mutex m_ring_mutex;
+  std::condition_variable m_ring_cv;
+  std::thread m_decode_thread;
   int fill_output_buffer();
-  void planar_to_interleaved(float **input_samples, float *output_samples,
-                             int length);
+  int decode_packet();
+  int drain_decoder();
+  int deliver(float **planes, int offset, int length);
+  int open_resampler();
+  int resample_frame();
+  int flush_resampler();
+  void finish_cache();
+  void wake();
+  void decode_loop();
+  int open_mapped_input();
+  static int read_mapped(void *opaque, uint8_t *buf, int buf_size);
+  static int64_t seek_mapped(void *opaque, int64_t offset, int whence);
+  void planar_to_interleaved(float **input_samples, int offset,
+                             float *output_samples, int length);
+  void copy_samples(float **input_samples, int offset, float *output_samples,
+                    int length);
 
 public:
-  track(std::string path);
-  int read(float *data_ptr, int num_samples);
+  track(std::string path, bool decode_ahead = false);
+  ~track();
+  int read(float *data_ptr, int num_samples, bool allow_short = false);
   int open_audio_source();
+  static void set_input_mode(input_mode_t mode);
   std::string get_path();
+  bool is_cached();
+  uint64_t get_steady_state_allocations();
+  double get_duration();
 };
 
 #define track_def
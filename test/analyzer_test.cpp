@@ -0,0 +1,122 @@
+#include "analyzer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks the median grid shift against the hill climb it replaced, and
+// times both.
+
+constexpr double max_anchor_diff = 0.001; // the hill climb's step
+constexpr double distance_slack = 1e-9;   // rounding in the summed distance
+constexpr int num_tracks = 200;
+
+using clock_type = std::chrono::steady_clock;
+
+double get_ms(clock_type::time_point start, clock_type::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+double get_distance(const std::vector<double> &v1,
+                    const std::vector<double> &v2) {
+  double distance = 0;
+  for (size_t i = 0; i < v1.size(); i++) {
+    distance += std::abs(v1[i] - v2[i]);
+  }
+  return distance;
+}
+
+void shift(std::vector<double> &v1, double shift_val) {
+  for (double &value : v1) {
+    value += shift_val;
+  }
+}
+
+// minimise_distance as it was, a hill climb in 1 ms steps
+void minimise_distance_climb(std::vector<double> &move,
+                             const std::vector<double> &nomove) {
+  int direction = 1;
+  double init_distance = get_distance(move, nomove);
+  shift(move, 0.001);
+  double fwd_distance = get_distance(move, nomove);
+  shift(move, -0.002);
+  double bwd_distance = get_distance(move, nomove);
+  shift(move, 0.001);
+  if (init_distance < fwd_distance && init_distance < bwd_distance) {
+    return;
+  } else if (fwd_distance > bwd_distance) {
+    direction = -1;
+  }
+  double nxt_distance = init_distance;
+  double prev_distance;
+  while (1) {
+    shift(move, direction * 0.001);
+    prev_distance = nxt_distance;
+    nxt_distance = get_distance(move, nomove);
+    if (nxt_distance > prev_distance) {
+      shift(move, direction * -0.001);
+      return;
+    }
+  }
+}
+
+// Consistent beats as get_bpm finds them, jittered and with a few missed
+// or doubled, against a template starting up to 50 ms away
+int check_minimise_distance() {
+  std::mt19937 generator(22);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  int trials = 0;
+  int worse = 0;
+  double max_diff = 0;
+  double climb_ms = 0;
+  double median_ms = 0;
+
+  for (int track = 0; track < num_tracks; track++) {
+    double bpm = 87.5 + 7.5 * uniform(generator);
+    double period = 60.0 / bpm;
+    int count = 100 + track;
+    std::vector<double> beats;
+    double time = 1 + uniform(generator);
+    for (int i = 0; i < count; i++) {
+      double jitter = 0.004 * uniform(generator);
+      if (uniform(generator) > 0.96) {
+        jitter += 0.5 * period; // a beat off the grid
+      }
+      beats.push_back(time + i * period + jitter);
+    }
+    std::vector<double> beat_template;
+    double start = beats[0] + 0.05 * uniform(generator);
+    for (int i = 0; i < count; i++) {
+      beat_template.push_back(start + i * period);
+    }
+
+    std::vector<double> climbed(beat_template);
+    std::vector<double> solved(beat_template);
+    auto a = clock_type::now();
+    minimise_distance_climb(climbed, beats);
+    auto b = clock_type::now();
+    analyzer::minimise_distance(solved, beats);
+    auto c = clock_type::now();
+    climb_ms += get_ms(a, b);
+    median_ms += get_ms(b, c);
+
+    trials++;
+    worse += get_distance(solved, beats) >
+             get_distance(climbed, beats) + distance_slack;
+    max_diff = std::max(max_diff, std::abs(solved[0] - climbed[0]));
+  }
+
+  bool passed = worse == 0 && max_diff <= max_anchor_diff;
+  std::cout << (passed ? "PASS" : "FAIL") << " minimise_distance: " << trials
+            << " grids, " << worse
+            << " with a larger summed distance than the hill climb, anchor "
+            << "within " << max_diff * 1000 << " ms of it (limit "
+            << max_anchor_diff * 1000 << " ms), hill climb " << climb_ms
+            << " ms, median " << median_ms << " ms" << std::endl;
+  return passed ? 0 : 1;
+}
+
+int main() { return check_minimise_distance(); }
@@ -0,0 +1,129 @@
+#include "qm/detection_function.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks the broadband detection function, which now tests each bin as
+// sqrmag > history * 10^(dbRise/10) in float, against the double
+// 10*log10(sqrmag/history) > dbRise test it replaced. The float path rounds
+// both powers, the ratio and their product to 24 bits, together within
+// about 1e-6 dB of the double values, so a bin within tie_db of the
+// threshold may fall either way. Each frame's count must match the old one
+// to within its number of such ties.
+
+constexpr double tie_db = 1e-5;
+constexpr unsigned int frame_length = 1024;
+constexpr unsigned int num_bins = frame_length / 2 + 1;
+constexpr int num_frames = 20000;
+
+// broadband as it was, with its own double history
+struct broadband_reference {
+  std::vector<double> history;
+  double db_rise;
+  broadband_reference(double rise) : history(num_bins, 0), db_rise(rise) {}
+
+  double process(const std::vector<double> &src, int &ties) {
+    double val = 0;
+    ties = 0;
+    if (src[0] < 0.001) {
+      return val;
+    }
+    for (unsigned int i = 0; i < num_bins; i++) {
+      double sqrmag = src[i] * src[i];
+      if (sqrmag <= 0.0) {
+        sqrmag = 0.001;
+      } else if (history[i] <= 0.0) {
+        history[i] = 0.001;
+      }
+      double diff = 10.0 * log10(sqrmag / history[i]);
+      if (diff > db_rise) {
+        val = val + 1;
+      }
+      ties += std::abs(diff - db_rise) < tie_db;
+      history[i] = sqrmag;
+    }
+    return val;
+  }
+};
+
+// Spectra drifting from frame to frame, with silent bins, quiet frames
+// skipped by both versions and bins placed exactly on the threshold
+std::vector<std::vector<double>> make_frames(double db_rise, int seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::normal_distribution<double> step(0, 2.5);
+  std::vector<std::vector<double>> frames(num_frames,
+                                          std::vector<double>(num_bins));
+  std::vector<double> level_db(num_bins, -20);
+  double ratio = pow(10.0, db_rise / 20.0);
+  for (int f = 0; f < num_frames; f++) {
+    for (unsigned int i = 0; i < num_bins; i++) {
+      level_db[i] =
+          std::min(20.0, std::max(-80.0, level_db[i] + step(generator)));
+      double magnitude = pow(10.0, level_db[i] / 20.0);
+      double draw = uniform(generator);
+      if (draw < 0.03) {
+        magnitude = 0;
+      } else if (draw < 0.031 && f > 0 && frames[f - 1][i] > 0) {
+        magnitude = frames[f - 1][i] * ratio; // a rise of exactly dbRise
+      }
+      frames[f][i] = magnitude;
+    }
+    if (uniform(generator) < 0.01) {
+      frames[f][0] = 0.0005;
+    }
+  }
+  return frames;
+}
+
+int check_db_rise(double db_rise, int seed) {
+  DFConfig config;
+  config.stepSize = frame_length / 2;
+  config.frameLength = frame_length;
+  config.DFType = DF_BROADBAND;
+  config.dbRise = db_rise;
+  config.adaptiveWhitening = false;
+  config.whiteningRelaxCoeff = -1;
+  config.whiteningFloor = -1;
+  detection_function df(config);
+  broadband_reference reference(db_rise);
+
+  std::vector<std::vector<double>> frames = make_frames(db_rise, seed);
+  long differing_bins = 0;
+  long tie_bins = 0;
+  int failed_frames = 0;
+  double float_ms = 0;
+  double log_ms = 0;
+  for (const auto &frame : frames) {
+    int ties;
+    auto a = std::chrono::steady_clock::now();
+    double count = df.processMagnitude(frame.data());
+    auto b = std::chrono::steady_clock::now();
+    double expected = reference.process(frame, ties);
+    auto c = std::chrono::steady_clock::now();
+    float_ms += std::chrono::duration<double, std::milli>(b - a).count();
+    log_ms += std::chrono::duration<double, std::milli>(c - b).count();
+    differing_bins += std::abs(count - expected);
+    tie_bins += ties;
+    failed_frames += std::abs(count - expected) > ties;
+  }
+
+  bool passed = failed_frames == 0;
+  std::cout << (passed ? "PASS" : "FAIL") << " broadband " << db_rise
+            << " dB: " << num_frames << " frames, " << differing_bins
+            << " bins counted differently, " << tie_bins << " within "
+            << tie_db << " dB of the threshold, " << failed_frames
+            << " frames differing by more than their ties, float "
+            << float_ms << " ms, log " << log_ms << " ms" << std::endl;
+  return passed ? 0 : 1;
+}
+
+int main() {
+  int failures = 0;
+  failures += check_db_rise(3, 1);   // beat tracker
+  failures += check_db_rise(3.6, 2); // onset detector
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include "decimator.h"
+#include "grid_anchor.h"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Places a drum attack on every beat at a known time, reads the track
+// through the decimator in onset hops as the analyzer does, and checks
+// that the anchor refined from a first beat up to most of a hop either
+// side lands within max_anchor_error of the attack at each analysis rate.
+// A block is 1/16th of an onset hop, 0.73 ms at any rate. The rise is
+// taken to peak at the centre of the block an attack falls in, but it
+// falls away slowly before the attack and sharply after it, so the
+// interpolated peak can sit up to a block early. The limit is a block and
+// a half, 1.09 ms. The decimator's delay is larger than the spread between
+// rates, so the anchors at the lower rates must also be within
+// max_rate_difference of the 44.1 kHz one from the same starting point.
+
+constexpr int full_rate = 44100;
+constexpr int full_rate_step = 512;
+constexpr double max_anchor_error = 1.5 * full_rate_step / 16 / full_rate;
+constexpr double max_rate_difference = 0.0005;
+constexpr double bpm = 90;
+constexpr double attack_time = 0.5123; // first attack, off any block edge
+constexpr double track_seconds = 60;
+
+// Decaying noise bursts over a quiet noise floor
+std::vector<float> make_track(int seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> noise(-1, 1);
+  std::vector<float> samples(track_seconds * full_rate);
+  double beat_seconds = 60.0 / bpm;
+  for (size_t i = 0; i < samples.size(); i++) {
+    double time = double(i) / full_rate;
+    double since = fmod(time - attack_time + beat_seconds, beat_seconds);
+    double level = 0.01;
+    if (time >= attack_time) {
+      level += 0.8 * exp(-since / 0.05);
+    }
+    samples[i] = level * noise(generator);
+  }
+  return samples;
+}
+
+const double start_errors[] = {-0.9, -0.5, -0.2, 0.0, 0.2, 0.5, 0.9}; // hops
+
+// The refined anchor from each starting point, as an offset from the attack
+std::vector<double> refine_at_rate(int factor,
+                                   const std::vector<float> &track) {
+  decimator track_decimator(factor);
+  std::vector<float> energy;
+  grid_anchor anchor(energy, full_rate / factor, full_rate_step / factor,
+                     track_decimator.get_delay());
+  std::vector<float> hop(full_rate_step / factor);
+  for (size_t start = 0; start + full_rate_step <= track.size();
+       start += full_rate_step) {
+    track_decimator.process(track.data() + start, full_rate_step, hop.data());
+    anchor.add(hop.data(), hop.size());
+  }
+
+  double hop_seconds = double(full_rate_step) / full_rate;
+  double beat_seconds = 60.0 / bpm;
+  std::vector<double> errors;
+  for (double start_error : start_errors) {
+    double first_beat = attack_time + start_error * hop_seconds;
+    first_beat += anchor.refine(bpm, first_beat);
+    errors.push_back(remainder(first_beat - attack_time, beat_seconds));
+  }
+  return errors;
+}
+
+int check_rate(int factor, const std::vector<double> &errors,
+               const std::vector<double> &full_rate_errors) {
+  int failures = 0;
+  double max_error = 0;
+  double max_difference = 0;
+  for (size_t i = 0; i < errors.size(); i++) {
+    double difference = std::abs(errors[i] - full_rate_errors[i]);
+    max_error = std::max(max_error, std::abs(errors[i]));
+    max_difference = std::max(max_difference, difference);
+    failures += std::abs(errors[i]) > max_anchor_error ||
+                difference > max_rate_difference;
+  }
+
+  bool passed = failures == 0;
+  std::cout << (passed ? "PASS" : "FAIL") << " grid anchor at "
+            << full_rate / factor << " Hz: " << failures << " of "
+            << errors.size() << " starting points failed, at most "
+            << max_error * 1000 << " ms from the attack (limit "
+            << max_anchor_error * 1000 << " ms) and "
+            << max_difference * 1000 << " ms from 44100 Hz (limit "
+            << max_rate_difference * 1000 << " ms)" << std::endl;
+  return passed ? 0 : 1;
+}
+
+int main() {
+  std::vector<float> track = make_track(20);
+  std::vector<double> full_rate_errors = refine_at_rate(1, track);
+  int failures = 0;
+  for (int factor : {1, 2, 4}) {
+    failures +=
+        check_rate(factor, refine_at_rate(factor, track), full_rate_errors);
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include "qm/tempo_track.h"
+
+#include <maths/MathUtilities.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks the rcfmat that calculateBeatPeriod builds from get_rcf, whose acf
+// is now taken with a zero padded FFT, against the direct loop acf it
+// replaced. Each rcf column is normalised to sum to 1, so the tolerance is
+// absolute. The acf is scaled from its zero lag, so this holds whether or
+// not the library's inverse FFT is scaled by 1/n.
+
+constexpr double tolerance = 1e-12;
+constexpr double input_tempo = 87.5;
+constexpr double track_seconds = 240;
+constexpr double eps = 0.0000008; // as EPS in tempo_track.cpp
+
+class tempo_track_test {
+public:
+  static void get_rcf(tempo_track &tracker, const std::vector<double> &frame,
+                      const std::vector<double> &wv,
+                      std::vector<double> &rcf) {
+    tracker.get_rcf(frame, wv, rcf);
+  }
+};
+
+// get_rcf as it was before the FFT, the acf summed lag by lag
+void get_rcf_direct(const std::vector<double> &frame_in,
+                    const std::vector<double> &wv, std::vector<double> &rcf) {
+  std::vector<double> frame(frame_in);
+  MathUtilities::adaptiveThreshold(frame);
+
+  std::vector<double> acf(frame.size());
+  for (size_t lag = 0; lag < frame.size(); lag++) {
+    double sum = 0;
+    for (size_t n = 0; n < frame.size() - lag; n++) {
+      sum += frame[n] * frame[n + lag];
+    }
+    acf[lag] = sum / (frame.size() - lag);
+  }
+
+  int num_elements = 4;
+  for (size_t i = 2; i < rcf.size(); i++) {
+    for (int a = 1; a <= num_elements; a++) {
+      for (int b = 1 - a; b <= a - 1; b++) {
+        rcf[i - 1] += (acf[(a * i + b) - 1] * wv[i - 1]) / (2. * a - 1.);
+      }
+    }
+  }
+
+  MathUtilities::adaptiveThreshold(rcf);
+  double rcf_sum = 0;
+  for (size_t i = 0; i < rcf.size(); i++) {
+    rcf[i] += eps;
+    rcf_sum += rcf[i];
+  }
+  for (size_t i = 0; i < rcf.size(); i++) {
+    rcf[i] /= (rcf_sum + eps);
+  }
+}
+
+// Drum hits on a two step pattern plus noise, as a broadband detection
+// function would give, at a fixed seed so every run sees the same input
+std::vector<double> make_detection_function(double frame_rate, double bpm,
+                                            int seed) {
+  std::mt19937 generator(seed);
+  std::normal_distribution<double> noise(0, 1);
+  std::vector<double> df(size_t(track_seconds * frame_rate), 0);
+  double eighth = 60.0 / bpm / 8;
+  for (long k = 0;; k++) {
+    double time = 0.5 + k * eighth;
+    long frame = lround(time * frame_rate);
+    if (frame >= long(df.size())) {
+      break;
+    }
+    int position = k % 16;
+    df[frame] += (position == 0 || position == 10)  ? 40
+                 : (position == 4 || position == 12) ? 25
+                 : position % 2 == 0                 ? 8
+                                                     : 0;
+  }
+  for (double &value : df) {
+    value = std::max(0.0, value + 3 * std::abs(noise(generator)));
+  }
+  return df;
+}
+
+// The Rayleigh weighting and framing of calculateBeatPeriod
+int check_step_div(int step_div, int seed) {
+  double sample_rate = 44100;
+  int increment = 512 / step_div;
+  double frame_rate = sample_rate / increment;
+  std::vector<double> df =
+      make_detection_function(frame_rate, 80 + seed % 15, seed);
+
+  size_t wv_len = 128 * step_div;
+  size_t window = 512 * step_div;
+  size_t hop = 128 * step_div;
+  double rayparam = (60 * int(sample_rate) / increment) / input_tempo;
+  std::vector<double> wv(wv_len);
+  for (size_t i = 0; i < wv_len; i++) {
+    wv[i] = (i / pow(rayparam, 2.)) *
+            exp(-pow(double(i), 2.) / (2. * pow(rayparam, 2.)));
+  }
+
+  tempo_track tracker(sample_rate, increment, step_div);
+  double max_diff = 0;
+  double fft_ms = 0;
+  double direct_ms = 0;
+  int columns = 0;
+  for (size_t start = 0; start + window < df.size(); start += hop) {
+    std::vector<double> frame(df.begin() + start,
+                              df.begin() + start + window);
+    std::vector<double> rcf(wv_len, 0);
+    std::vector<double> expected(wv_len, 0);
+    auto a = std::chrono::steady_clock::now();
+    tempo_track_test::get_rcf(tracker, frame, wv, rcf);
+    auto b = std::chrono::steady_clock::now();
+    get_rcf_direct(frame, wv, expected);
+    auto c = std::chrono::steady_clock::now();
+    fft_ms += std::chrono::duration<double, std::milli>(b - a).count();
+    direct_ms += std::chrono::duration<double, std::milli>(c - b).count();
+    for (size_t i = 0; i < wv_len; i++) {
+      max_diff = std::max(max_diff, std::abs(rcf[i] - expected[i]));
+    }
+    columns++;
+  }
+
+  bool passed = max_diff <= tolerance;
+  std::cout << (passed ? "PASS" : "FAIL") << " rcfmat step_div " << step_div
+            << ": " << columns << " columns, max abs diff " << max_diff
+            << " (tolerance " << tolerance << "), direct " << direct_ms
+            << " ms, fft " << fft_ms << " ms" << std::endl;
+  return passed ? 0 : 1;
+}
+
+int main() {
+  int failures = 0;
+  for (int step_div : {1, 2, 4}) {
+    for (int seed : {1, 2}) {
+      failures += check_step_div(step_div, seed);
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}